@@ -0,0 +1,35 @@
+# Writes the bytes of INPUT to OUTPUT as a C++ header declaring
+# `constexpr std::array<uint8_t, size> NAME`.
+#
+#   cmake -DINPUT=file.bin -DOUTPUT=file.h -DNAME=FILE -P embed_file.cmake
+
+file(READ ${INPUT} data HEX)
+string(LENGTH "${data}" length)
+math(EXPR size "${length} / 2")
+
+# 12 bytes a line.
+set(bytes "")
+set(offset 0)
+while(offset LESS length)
+	string(SUBSTRING "${data}" ${offset} 24 line)
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " line "${line}")
+	string(STRIP "${line}" line)
+	set(bytes "${bytes}    ${line}\n")
+	math(EXPR offset "${offset} + 24")
+endwhile()
+
+get_filename_component(input_name ${INPUT} NAME)
+file(WRITE ${OUTPUT}
+"// Generated from ${input_name} by cmake/embed_file.cmake, don't edit.
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace gb {
+
+constexpr std::array<uint8_t, ${size}> ${NAME} = {
+${bytes}};
+
+} // namespace gb
+")
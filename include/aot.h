@@ -0,0 +1,117 @@
+#pragma once
+
+#include "cpu.h"
+#include "opcodes.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+// Translated basic block, returns the machine cycles it ran for.
+typedef uint32_t (*aot_block_t)(CPU &cpu);
+
+struct AotBlock {
+  // ROM bank mapped at the start address, and the address.
+  uint32_t key;
+  aot_block_t run;
+};
+
+// Runtime side of the ahead of time recompiler. `gamerboy-aot` translates a
+// ROM into C++ that is linked into the emulator, each block calls back into
+// the `CPU` through these helpers.
+struct Aot {
+  // Generated, `blocks` is sorted by key.
+  static const AotBlock blocks[];
+  static const std::size_t block_count;
+  // Cartridge header, 0x134-0x14F, of the ROM the blocks were generated from.
+  static const std::array<uint8_t, 0x1C> rom_header;
+
+  static const AotBlock *find(uint32_t key) {
+    const AotBlock *end = blocks + block_count;
+    const AotBlock *it = std::lower_bound(
+        blocks, end, key,
+        [](const AotBlock &block, uint32_t key) { return block.key < key; });
+    return it != end && it->key == key ? it : nullptr;
+  }
+
+  // Runs an instruction the generator didn't translate on its interpreter
+  // handler, returns the cycles it took. `block_cycles` is what the block
+  // has counted before it.
+  static uint32_t execute(CPU &cpu, uint8_t opcode, uint16_t immediate,
+                          uint16_t next_pc, uint32_t block_cycles) {
+    uint64_t block_start = cpu.m_batch_elapsed;
+    cpu.m_batch_elapsed += block_cycles;
+    cpu.m_registers.pc = next_pc;
+    cpu.m_immediate = immediate;
+    (cpu.*CPU::opcode_table[opcode])(opcode);
+    cpu.m_batch_elapsed = block_start;
+    return OPCODE_CYCLES[opcode] + cpu.take_extra_cycles();
+  }
+
+  static uint32_t execute_cb(CPU &cpu, uint8_t opcode, uint16_t next_pc,
+                             uint32_t block_cycles) {
+    uint64_t block_start = cpu.m_batch_elapsed;
+    cpu.m_batch_elapsed += block_cycles;
+    cpu.m_registers.pc = next_pc;
+    (cpu.*CPU::cb_opcode_table[opcode])(opcode);
+    cpu.m_batch_elapsed = block_start;
+    return CB_OPCODE_CYCLES[opcode];
+  }
+
+  // Whether the block has to stop early, after `block_cycles`: at the batch
+  // deadline, or after a write switched banks or moved the deadline.
+  static bool exit_block(CPU &cpu, uint32_t block_cycles) {
+    return cpu.m_exit_block ||
+           cpu.m_batch_elapsed + block_cycles >= cpu.m_batch_cycles;
+  }
+
+  static void jump(CPU &cpu, uint16_t address) { cpu.m_registers.pc = address; }
+
+  // Register operands, `(HL)` always goes through `execute`.
+  template <Operand r> static uint8_t read(CPU &cpu) {
+    static_assert(r != Operand::DHL);
+    if constexpr (r == Operand::A)
+      return cpu.m_registers[AF].get_upper_register();
+    else if constexpr (static_cast<uint8_t>(r) & 0x01)
+      return cpu.m_registers[static_cast<uint8_t>(r) / 2 + 1]
+          .get_lower_register();
+    else
+      return cpu.m_registers[static_cast<uint8_t>(r) / 2 + 1]
+          .get_upper_register();
+  }
+
+  template <Operand r> static void write(CPU &cpu, uint8_t value) {
+    static_assert(r != Operand::DHL);
+    if constexpr (r == Operand::A)
+      cpu.m_registers[AF].set_upper_register(value);
+    else if constexpr (static_cast<uint8_t>(r) & 0x01)
+      cpu.m_registers[static_cast<uint8_t>(r) / 2 + 1].set_lower_register(
+          value);
+    else
+      cpu.m_registers[static_cast<uint8_t>(r) / 2 + 1].set_upper_register(
+          value);
+  }
+
+  // BC, DE, HL, SP
+  template <uint8_t rr> static void write16(CPU &cpu, uint16_t value) {
+    cpu.m_registers[rr] = value;
+  }
+
+  template <uint8_t rr> static void increment(CPU &cpu) {
+    cpu.m_registers[rr]++;
+  }
+
+  template <uint8_t rr> static void decrement(CPU &cpu) {
+    cpu.m_registers[rr]--;
+  }
+
+  // add, adc, sub, sbc, and, xor, or, cp
+  template <uint8_t operation> static void alu(CPU &cpu, uint8_t value) {
+    cpu.alu_a_r<operation>(value);
+  }
+};
+
+} // namespace gb
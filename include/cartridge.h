@@ -3,6 +3,8 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <span>
+#include <variant>
 #include <vector>
 
 namespace gb {
@@ -15,49 +17,140 @@ public:
     GB_NO_MBC,
     GB_MBC1,
     GB_MBC3,
+    GB_MBC5,
   };
 
-  CartridgeInformation(const std::vector<std::byte> &rom) {
-
-    auto rom_cast = [&](uint16_t address) -> uint16_t {
-      return static_cast<uint16_t>(rom[address]);
-    };
-
-    m_ram_size = ram_sizes[rom_cast(0x149)];
-    m_version = rom_cast(0x14C);
-  }
+  CartridgeInformation(std::span<const std::byte> rom);
 
+  CartridgeType get_type() { return m_type; }
   uint32_t get_ram_size() { return m_ram_size; }
   uint8_t get_version() { return m_version; }
+  // Whether the logo and header checksum pass the check in Nintendo's boot
+  // ROM, it locks up when they don't.
+  bool is_header_valid() { return m_header_valid; }
 
 private:
+  CartridgeType m_type;
   uint32_t m_ram_size;
   uint8_t m_version;
+  bool m_header_valid;
 };
 
-class Cartridge {
+// Mapper registers. They only track which banks are selected, `Cartridge`
+// turns that into the memory the banks are in.
+class NoMbc {
 public:
-  Cartridge(const std::vector<std::byte> &data)
-      : m_rom_data(data), m_cartridge_info(m_rom_data){};
+  void write(uint16_t addr, uint8_t value) {}
 
-  virtual ~Cartridge() = default;
+  uint16_t get_rom_bank0() const { return 0; }
+  uint16_t get_rom_bank() const { return 1; }
+  uint8_t get_ram_bank() const { return 0; }
+  bool is_ram_enabled() const { return true; }
+};
 
-  virtual uint8_t read(uint16_t addr) = 0;
-  virtual void write(uint16_t addr, uint8_t value) = 0;
+class Mbc1 {
+public:
+  void write(uint16_t addr, uint8_t value);
 
-protected:
-  const std::vector<std::byte> &m_rom_data;
-  const std::vector<std::byte> m_ram_data;
+  // In mode 1 the upper bits also select the bank at 0x0000-0x3FFF, and the
+  // RAM bank.
+  uint16_t get_rom_bank0() const { return m_mode ? m_upper_bank << 5 : 0; }
+  uint16_t get_rom_bank() const { return m_upper_bank << 5 | m_lower_bank; }
+  uint8_t get_ram_bank() const { return m_mode ? m_upper_bank : 0; }
+  bool is_ram_enabled() const { return m_ram_enabled; }
 
-  CartridgeInformation m_cartridge_info;
+private:
+  bool m_ram_enabled = false;
+  uint8_t m_lower_bank = 1;
+  uint8_t m_upper_bank = 0;
+  bool m_mode = false;
+};
+
+class Mbc3 {
+public:
+  void write(uint16_t addr, uint8_t value);
+
+  uint16_t get_rom_bank0() const { return 0; }
+  uint16_t get_rom_bank() const { return m_rom_bank; }
+  // 0x08-0x0C select a clock register instead of RAM.
+  uint8_t get_ram_bank() const { return m_ram_bank; }
+  bool is_ram_enabled() const { return m_ram_enabled; }
+
+  bool is_clock_selected() const { return m_ram_bank >= 0x08; }
+  uint8_t read_clock() const;
+  void write_clock(uint8_t value);
+
+private:
+  bool m_ram_enabled = false;
+  uint8_t m_rom_bank = 1;
+  uint8_t m_ram_bank = 0;
+  // Seconds, minutes, hours, day low, day high.
+  std::array<uint8_t, 5> m_clock{};
 };
 
-class NoMbc : protected Cartridge {
+class Mbc5 {
 public:
-  NoMbc(const std::vector<std::byte> &data) : Cartridge(data) {}
+  void write(uint16_t addr, uint8_t value);
+
+  uint16_t get_rom_bank0() const { return 0; }
+  uint16_t get_rom_bank() const { return m_rom_bank; }
+  uint8_t get_ram_bank() const { return m_ram_bank; }
+  bool is_ram_enabled() const { return m_ram_enabled; }
 
-  virtual uint8_t read(uint16_t addr) override;
-  virtual void write(uint16_t addr, uint8_t value) override;
+private:
+  bool m_ram_enabled = false;
+  uint16_t m_rom_bank = 1;
+  uint8_t m_ram_bank = 0;
+};
+
+// ROM, external RAM and the mapper picked from the header. Nothing here is
+// called per byte: `Memory` maps the selected banks straight into its pages
+// and only comes back after a write to the mapper.
+class Cartridge {
+public:
+  // `data` has to outlive the cartridge, it's never copied.
+  Cartridge(std::span<const std::byte> data);
+
+  // Writes to 0x0000-0x7FFF, the selected banks can change.
+  void write(uint16_t addr, uint8_t value);
+
+  // Banks mapped at 0x0000-0x3FFF and 0x4000-0x7FFF, wrapped to the size of
+  // the ROM.
+  uint16_t get_rom_bank0() const;
+  uint16_t get_rom_bank() const;
+
+  CartridgeInformation &get_info() { return m_cartridge_info; }
+
+  const uint8_t *get_rom_data() const {
+    return reinterpret_cast<const uint8_t *>(m_rom_data.data());
+  }
+  std::size_t get_rom_size() const { return m_rom_data.size(); }
+
+  // RAM mapped at 0xA000-0xBFFF, `nullptr` when it's disabled or the mapper
+  // has something else there. Smaller RAM only fills the start.
+  uint8_t *get_ram_bank_data();
+  std::size_t get_ram_bank_size() const;
+
+  // 0xA000-0xBFFF where there's no RAM to map.
+  uint8_t read_ram(uint16_t addr);
+  void write_ram(uint16_t addr, uint8_t value);
+
+  // 0x0000-0x7FFF through the selected banks, for code outside the memory
+  // map.
+  uint8_t read(uint16_t addr) const;
+
+private:
+  typedef std::variant<NoMbc, Mbc1, Mbc3, Mbc5> mbc_t;
+
+  static mbc_t make_mbc(CartridgeInformation::CartridgeType type);
+
+  std::span<const std::byte> m_rom_data;
+  std::vector<uint8_t> m_ram_data;
+
+  CartridgeInformation m_cartridge_info;
+  mbc_t m_mbc;
+  // Number of 16 KiB ROM banks, bank numbers wrap around at this.
+  std::size_t m_rom_banks;
 };
 
 } // namespace gb
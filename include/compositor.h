@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+// What the four colors a palette picks from look like, lightest first.
+constexpr std::array<uint32_t, 4> SHADES{0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555,
+                                         0xFF000000};
+
+// Bits of the sprite flags of a line.
+enum SpriteFlags : uint8_t {
+  // OBP1 instead of OBP0.
+  SPRITE_PALETTE_1 = 0x01,
+  // Behind background colors 1-3.
+  SPRITE_BEHIND = 0x02,
+};
+
+// BGP, OBP0 and OBP1.
+struct Palettes {
+  uint8_t background;
+  uint8_t object_0;
+  uint8_t object_1;
+};
+
+// Color numbers of a line, the background with the window already over it,
+// and the sprite pixel that won at every position with its flags. Sprite
+// color 0 is no sprite.
+struct LineLayers {
+  const uint8_t *background;
+  const uint8_t *sprites;
+  const uint8_t *sprite_flags;
+};
+
+// Merges the layers of `count` pixels, a multiple of 32, and maps them
+// through the palettes to ARGB8888.
+typedef void (*compositor_t)(const LineLayers &layers, std::size_t count,
+                             const Palettes &palettes, uint32_t *pixels);
+
+// One pixel at a time, what the others have to match.
+void composite_scalar(const LineLayers &layers, std::size_t count,
+                      const Palettes &palettes, uint32_t *pixels);
+
+#if defined(__x86_64__)
+void composite_sse2(const LineLayers &layers, std::size_t count,
+                    const Palettes &palettes, uint32_t *pixels);
+void composite_avx2(const LineLayers &layers, std::size_t count,
+                    const Palettes &palettes, uint32_t *pixels);
+#endif
+
+// The fastest one the host CPU runs.
+compositor_t get_compositor();
+
+} // namespace gb
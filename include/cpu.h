@@ -4,13 +4,30 @@
 #include "memory.h"
 #include "registers.h"
 
+#if defined(GAMERBOY_JIT)
+#include "jit.h"
+#endif
+
 #include <array>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
-#include <map>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace gb {
 
 class Gameboy;
+class CPU;
+struct RegisterFile;
+
+#if defined(GAMERBOY_JIT)
+// Recompiled block, takes the register file and returns the machine cycles it
+// ran for.
+typedef int32_t (*native_block_t)(CPU *cpu, RegisterFile *registers);
+#endif
 
 constexpr uint8_t WORD_REGISTER_LENGTH = 5;
 
@@ -30,134 +47,232 @@ enum Flags {
   ZERO_FLAG = 0x80,
 };
 
+// Bits of IF and IE, lower bits are serviced first.
+enum Interrupts {
+  VBLANK_INTERRUPT = 0x01,
+  LCD_STAT_INTERRUPT = 0x02,
+  TIMER_INTERRUPT = 0x04,
+  SERIAL_INTERRUPT = 0x08,
+  JOYPAD_INTERRUPT = 0x10,
+};
+
+// ALU operations the flags can be worked out from after the fact, see
+// `CPU::compute_flags`. ADC, INC and DEC are an ADD, SBC and CP a SUB, and XOR
+// an OR.
+enum class FlagOperation : uint8_t {
+  NONE,
+  ADD,
+  SUB,
+  AND,
+  OR,
+};
+
+// Everything the CPU carries from one instruction to the next, in one
+// trivially copyable block so snapshotting it is a single copy.
+struct alignas(64) RegisterFile {
+  std::array<DoubleRegister, WORD_REGISTER_LENGTH> pairs;
+  uint16_t pc = 0;
+  // IME
+  uint8_t interrupt_enable = 0;
+  // Set by EI, IME only comes on after the instruction that follows it.
+  bool interrupt_enable_pending = false;
+  // IF and IE
+  uint8_t interrupt_flag = 0;
+  uint8_t interrupt_mask = 0;
+  bool halted = false;
+
+#if defined(GAMERBOY_LAZY_FLAGS)
+  // Last ALU operation, F is stale while this isn't `NONE`.
+  FlagOperation flag_operation = FlagOperation::NONE;
+  uint8_t flag_a = 0;
+  uint8_t flag_value = 0;
+  uint16_t flag_result = 0;
+#endif
+
+  DoubleRegister &operator[](std::size_t i) { return pairs[i]; }
+  const DoubleRegister &operator[](std::size_t i) const { return pairs[i]; }
+};
+
+static_assert(std::is_trivially_copyable_v<RegisterFile>);
+
+// 8-bit operands, in the order the opcode bits encode them.
+enum class Operand : uint8_t {
+  B,
+  C,
+  D,
+  E,
+  H,
+  L,
+  DHL,
+  A,
+};
+
 class CPU {
 public:
   CPU(Gameboy &gb);
 
   uint8_t cycle();
 
+  // Executes instructions in one batch until the machine cycle count since
+  // power on reaches `cycle_deadline`, returns the new count. The last
+  // instruction can run past the deadline, the next batch is shorter by as
+  // much.
+  uint64_t run_until(uint64_t cycle_deadline);
+
+  // Machine cycles since power on. Mid batch this is where the running
+  // instruction started, so I/O registers can be worked out from it.
+  uint64_t get_cycles() const { return m_cycles + m_batch_elapsed; }
+
+  // Ends the running batch after the current instruction if `cycle_deadline`
+  // comes before the batch would have ended, for events scheduled while the
+  // CPU runs.
+  void shorten_batch(uint64_t cycle_deadline);
+
+  void request_interrupt(uint8_t interrupt);
+  // IF and IE, `Memory` masks off the bits that don't exist.
+  uint8_t read_interrupt_flag() const { return m_registers.interrupt_flag; }
+  void write_interrupt_flag(uint8_t value);
+  uint8_t read_interrupt_enable() const { return m_registers.interrupt_mask; }
+  void write_interrupt_enable(uint8_t value);
+
+  // Starts at 0x0100 with the registers the boot ROM hands over with, at
+  // machine cycle `cycle`.
+  void skip_boot(uint64_t cycle);
+
 private:
-  uint8_t read_memory(uint16_t address);
-  void write_memory(uint16_t address, uint8_t value);
+  // Executes instructions until at least `m_batch_cycles` machine cycles
+  // have elapsed, returns how many actually did. One per CPU engine.
+  uint64_t run();
+
+  // Wakes up from HALT and services the highest priority interrupt. Only
+  // done in between batches, interrupts are raised by events and by the
+  // instructions that end a batch.
+  void handle_interrupts();
 
-  bool condition_code(uint8_t opcode);
-  inline uint8_t get_register(uint8_t opcode) { return (opcode >> 4) + 1; }
-  inline uint8_t get_conditional_code(uint8_t opcode) { return (opcode >> 3); }
+  // EI ends its batch, this runs the instruction after it on its own and
+  // then turns IME on, so nothing gets serviced in between.
+  void enable_interrupts_delayed();
 
-  uint16_t m_pc;
-  uint8_t m_interrupt_enable;
+  uint8_t read_memory(uint16_t address);
+  void write_memory(uint16_t address, uint8_t value);
 
-  std::array<DoubleRegister, WORD_REGISTER_LENGTH> m_registers;
+  // Immediates are fetched before the handler runs, see `OPCODE_LENGTH`.
+  void fetch_immediate(uint8_t opcode);
+  inline uint8_t read_d8() { return static_cast<uint8_t>(m_immediate); }
+  inline uint16_t read_d16() { return m_immediate; }
+
+  void push(uint16_t value);
+  uint16_t pop();
+
+  // Operand decoding, all of these are resolved at compile time.
+  static constexpr Operand get_operand(uint8_t bits) {
+    return static_cast<Operand>(bits & 0x07);
+  }
+  // BC, DE, HL, SP
+  static constexpr uint8_t get_register(uint8_t opcode) {
+    return ((opcode >> 4) & 0x03) + 1;
+  }
+  // BC, DE, HL, AF
+  static constexpr uint8_t get_stack_register(uint8_t opcode) {
+    return get_register(opcode) & 0x03;
+  }
+  // nz, z, nc, c
+  static constexpr uint8_t get_conditional_code(uint8_t opcode) {
+    return (opcode >> 3) & 0x03;
+  }
+
+  template <uint8_t opcode> bool condition_code();
+
+  // F. In lazy flags mode the ALU helpers only record their operands, the
+  // flags are worked out here the first time something reads them.
+  uint8_t get_flags();
+  bool get_zero();
+  bool get_carry();
+  void set_flags(uint8_t flags);
+  // For the instructions that leave some of the flags alone.
+  void set_flag(uint8_t flag, bool set);
+
+  // Flags of `result = a op value`, where bit 8 of `result` is the carry
+  // out. For AND and OR `a` is the result and `value` zero.
+  static constexpr uint8_t compute_flags(FlagOperation operation, uint8_t a,
+                                         uint8_t value, uint16_t result);
+  void set_alu_flags(FlagOperation operation, uint8_t a, uint8_t value,
+                     uint16_t result);
+
+  template <Operand r> uint8_t read_operand();
+  template <Operand r> void write_operand(uint8_t value);
+
+  // Cycles on top of `OPCODE_CYCLES` spent by the last instruction, from
+  // taking a conditional branch or running a CB prefixed opcode.
+  inline uint8_t take_extra_cycles() {
+    return std::exchange(m_extra_cycles, 0);
+  }
+
+  uint8_t m_extra_cycles = 0;
+  uint16_t m_immediate = 0;
+
+  RegisterFile m_registers;
+  uint64_t m_cycles = 0;
+  // Length of the running batch, 0 outside of `run_until`.
+  uint64_t m_batch_cycles = 0;
+  // Cycles into the running batch the current instruction started at. Every
+  // engine updates it before an instruction that can touch memory.
+  uint64_t m_batch_elapsed = 0;
 
   Gameboy &m_gb;
-  NoMbc &m_cartridge;
+  Cartridge &m_cartridge;
   Memory &m_memory;
 
   typedef void (CPU::*opcode_method_t)(uint8_t);
 
   // Opcode names:
-  // r = 8-bit register
-  // lr = low 8-bit register
-  // hr = high 8-bit register
+  // r = 8-bit register, or (HL)
   // rr = 16-bit register
   // d8 = 8-bit immediate
   // d16 = 16-bit immediate
+  // a8 = 8-bit address, offset from 0xFF00
+  // a16 = 16-bit address
+  // r8 = 8-bit signed offset
   // d.. = [..]
   // cc = condition code (z, nz, c, nc)
+  // n = bit index
+  //
+  // Handlers templated on the opcode decode their operands from it at
+  // compile time, so every opcode gets its own specialised handler.
 
   void op_nop(uint8_t opcode);
+  void op_illegal(uint8_t opcode);
 
   // Load
   void op_ld_da8_a(uint8_t opcode);
+  void op_ld_a_da8(uint8_t opcode);
+  void op_ld_dc_a(uint8_t opcode);
+  void op_ld_a_dc(uint8_t opcode);
+  void op_ld_da16_a(uint8_t opcode);
+  void op_ld_a_da16(uint8_t opcode);
   void op_ld_da16_sp(uint8_t opcode);
-  void op_ld_hr_d8(uint8_t opcode);
-  void op_ld_lr_d8(uint8_t opcode);
-  void op_ld_rr_d16(uint8_t opcode);
-  void op_ld_drr_a(uint8_t opcode);
-  void op_ld_a_drr(uint8_t opcode);
   void op_ld_dhli_a(uint8_t opcode);
   void op_ld_a_dhli(uint8_t opcode);
   void op_ld_dhld_a(uint8_t opcode);
   void op_ld_a_dhld(uint8_t opcode);
-  void op_ld_dhl_d8(uint8_t opcode);
-
-  void op_ld_b_c(uint8_t opcode);
-  void op_ld_b_d(uint8_t opcode);
-  void op_ld_b_e(uint8_t opcode);
-  void op_ld_b_h(uint8_t opcode);
-  void op_ld_b_l(uint8_t opcode);
-  void op_ld_b_dhl(uint8_t opcode);
-  void op_ld_b_a(uint8_t opcode);
-
-  void op_ld_c_b(uint8_t opcode);
-  void op_ld_c_d(uint8_t opcode);
-  void op_ld_c_e(uint8_t opcode);
-  void op_ld_c_h(uint8_t opcode);
-  void op_ld_c_l(uint8_t opcode);
-  void op_ld_c_dhl(uint8_t opcode);
-  void op_ld_c_a(uint8_t opcode);
-
-  void op_ld_d_b(uint8_t opcode);
-  void op_ld_d_c(uint8_t opcode);
-  void op_ld_d_e(uint8_t opcode);
-  void op_ld_d_h(uint8_t opcode);
-  void op_ld_d_l(uint8_t opcode);
-  void op_ld_d_dhl(uint8_t opcode);
-  void op_ld_d_a(uint8_t opcode);
-
-  void op_ld_e_b(uint8_t opcode);
-  void op_ld_e_c(uint8_t opcode);
-  void op_ld_e_d(uint8_t opcode);
-  void op_ld_e_h(uint8_t opcode);
-  void op_ld_e_l(uint8_t opcode);
-  void op_ld_e_dhl(uint8_t opcode);
-  void op_ld_e_a(uint8_t opcode);
-
-  void op_ld_h_b(uint8_t opcode);
-  void op_ld_h_c(uint8_t opcode);
-  void op_ld_h_d(uint8_t opcode);
-  void op_ld_h_e(uint8_t opcode);
-  void op_ld_h_l(uint8_t opcode);
-  void op_ld_h_dhl(uint8_t opcode);
-  void op_ld_h_a(uint8_t opcode);
-
-  void op_ld_l_b(uint8_t opcode);
-  void op_ld_l_c(uint8_t opcode);
-  void op_ld_l_d(uint8_t opcode);
-  void op_ld_l_e(uint8_t opcode);
-  void op_ld_l_h(uint8_t opcode);
-  void op_ld_l_dhl(uint8_t opcode);
-  void op_ld_l_a(uint8_t opcode);
-
-  void op_ld_dhl_b(uint8_t opcode);
-  void op_ld_dhl_c(uint8_t opcode);
-  void op_ld_dhl_d(uint8_t opcode);
-  void op_ld_dhl_e(uint8_t opcode);
-  void op_ld_dhl_h(uint8_t opcode);
-  void op_ld_dhl_l(uint8_t opcode);
-  void op_ld_dhl_a(uint8_t opcode);
-
-  void op_ld_a_b(uint8_t opcode);
-  void op_ld_a_c(uint8_t opcode);
-  void op_ld_a_d(uint8_t opcode);
-  void op_ld_a_e(uint8_t opcode);
-  void op_ld_a_h(uint8_t opcode);
-  void op_ld_a_l(uint8_t opcode);
-  void op_ld_a_dhl(uint8_t opcode);
-
-  // Inc and Dec 16 bit
-  void op_inc_rr(uint8_t opcode);
-  void op_dec_rr(uint8_t opcode);
-  void op_inc_dhl(uint8_t opcode);
-  void op_dec_dhl(uint8_t opcode);
-
-  // Inc and Dec 8 bit high reg
-  void op_inc_hr(uint8_t opcode);
-  void op_dec_hr(uint8_t opcode);
-
-  // Inc and Dec 8 bit low reg
-  void op_inc_lr(uint8_t opcode);
-  void op_dec_lr(uint8_t opcode);
+  void op_ld_hl_sp_r8(uint8_t opcode);
+  void op_ld_sp_hl(uint8_t opcode);
+
+  template <uint8_t opcode> void op_ld_r_r(uint8_t);
+  template <uint8_t opcode> void op_ld_r_d8(uint8_t);
+  template <uint8_t opcode> void op_ld_rr_d16(uint8_t);
+  template <uint8_t opcode> void op_ld_drr_a(uint8_t);
+  template <uint8_t opcode> void op_ld_a_drr(uint8_t);
+
+  // Stack
+  template <uint8_t opcode> void op_push_rr(uint8_t);
+  template <uint8_t opcode> void op_pop_rr(uint8_t);
+
+  // Inc and Dec
+  template <uint8_t opcode> void op_inc_r(uint8_t);
+  template <uint8_t opcode> void op_dec_r(uint8_t);
+  template <uint8_t opcode> void op_inc_rr(uint8_t);
+  template <uint8_t opcode> void op_dec_rr(uint8_t);
 
   // Rotate
   void op_rlca(uint8_t opcode);
@@ -165,326 +280,246 @@ private:
   void op_rrca(uint8_t opcode);
   void op_rra(uint8_t opcode);
 
-  // Add
-  void op_add_hl_rr(uint8_t opcode);
-
-  void op_add_a_b(uint8_t opcode);
-  void op_add_a_c(uint8_t opcode);
-  void op_add_a_d(uint8_t opcode);
-  void op_add_a_e(uint8_t opcode);
-  void op_add_a_h(uint8_t opcode);
-  void op_add_a_l(uint8_t opcode);
-  void op_add_a_dhl(uint8_t opcode);
-  void op_add_a_a(uint8_t opcode);
-
-  void op_adc_a_b(uint8_t opcode);
-  void op_adc_a_c(uint8_t opcode);
-  void op_adc_a_d(uint8_t opcode);
-  void op_adc_a_e(uint8_t opcode);
-  void op_adc_a_h(uint8_t opcode);
-  void op_adc_a_l(uint8_t opcode);
-  void op_adc_a_dhl(uint8_t opcode);
-  void op_adc_a_a(uint8_t opcode);
+  // Arithmetic and binary operations, the operation is encoded in bits 3-5:
+  // add, adc, sub, sbc, and, xor, or, cp
+  template <uint8_t opcode> void op_alu_a_r(uint8_t);
+  template <uint8_t opcode> void op_alu_a_d8(uint8_t);
+  template <uint8_t opcode> void op_add_hl_rr(uint8_t);
+  void op_add_sp_r8(uint8_t opcode);
 
+  template <uint8_t operation> void alu_a_r(uint8_t value);
+
+  // Helper methods that the opcodes call, to try and avoid
+  // duplicate code.
   void add_a_r(uint8_t value);
   void adc_a_r(uint8_t value);
-
-  // Sub
-  void op_sub_a_b(uint8_t opcode);
-  void op_sub_a_c(uint8_t opcode);
-  void op_sub_a_d(uint8_t opcode);
-  void op_sub_a_e(uint8_t opcode);
-  void op_sub_a_h(uint8_t opcode);
-  void op_sub_a_l(uint8_t opcode);
-  void op_sub_a_dhl(uint8_t opcode);
-  void op_sub_a_a(uint8_t opcode);
-
-  void op_sbc_a_b(uint8_t opcode);
-  void op_sbc_a_c(uint8_t opcode);
-  void op_sbc_a_d(uint8_t opcode);
-  void op_sbc_a_e(uint8_t opcode);
-  void op_sbc_a_h(uint8_t opcode);
-  void op_sbc_a_l(uint8_t opcode);
-  void op_sbc_a_dhl(uint8_t opcode);
-  void op_sbc_a_a(uint8_t opcode);
-
   void sub_a_r(uint8_t value);
   void sbc_a_r(uint8_t value);
-
-  // Binary operations
-  void op_and_a_b(uint8_t opcode);
-  void op_and_a_c(uint8_t opcode);
-  void op_and_a_d(uint8_t opcode);
-  void op_and_a_e(uint8_t opcode);
-  void op_and_a_h(uint8_t opcode);
-  void op_and_a_l(uint8_t opcode);
-  void op_and_a_dhl(uint8_t opcode);
-  void op_and_a_a(uint8_t opcode);
-
-  void op_xor_a_b(uint8_t opcode);
-  void op_xor_a_c(uint8_t opcode);
-  void op_xor_a_d(uint8_t opcode);
-  void op_xor_a_e(uint8_t opcode);
-  void op_xor_a_h(uint8_t opcode);
-  void op_xor_a_l(uint8_t opcode);
-  void op_xor_a_dhl(uint8_t opcode);
-  void op_xor_a_a(uint8_t opcode);
-
-  void op_or_a_b(uint8_t opcode);
-  void op_or_a_c(uint8_t opcode);
-  void op_or_a_d(uint8_t opcode);
-  void op_or_a_e(uint8_t opcode);
-  void op_or_a_h(uint8_t opcode);
-  void op_or_a_l(uint8_t opcode);
-  void op_or_a_dhl(uint8_t opcode);
-  void op_or_a_a(uint8_t opcode);
-
-  void op_cp_a_b(uint8_t opcode);
-  void op_cp_a_c(uint8_t opcode);
-  void op_cp_a_d(uint8_t opcode);
-  void op_cp_a_e(uint8_t opcode);
-  void op_cp_a_h(uint8_t opcode);
-  void op_cp_a_l(uint8_t opcode);
-  void op_cp_a_dhl(uint8_t opcode);
-  void op_cp_a_a(uint8_t opcode);
-
-  // Helper methods that the opcodes call, to try and avoid
-  // duplicate code.
   void and_a_r(uint8_t value);
   void xor_a_r(uint8_t value);
   void or_a_r(uint8_t value);
   void cp_a_r(uint8_t value);
+  uint16_t add_sp_r8();
 
   // Jumps
   void op_jr_r8(uint8_t opcode);
-  void op_jr_cc_r8(uint8_t opcode);
+  void op_jp_a16(uint8_t opcode);
+  void op_jp_hl(uint8_t opcode);
+  void op_call_a16(uint8_t opcode);
+  void op_ret(uint8_t opcode);
+  void op_reti(uint8_t opcode);
+
+  template <uint8_t opcode> void op_jr_cc_r8(uint8_t);
+  template <uint8_t opcode> void op_jp_cc_a16(uint8_t);
+  template <uint8_t opcode> void op_call_cc_a16(uint8_t);
+  template <uint8_t opcode> void op_ret_cc(uint8_t);
+  template <uint8_t opcode> void op_rst(uint8_t);
 
   void op_daa(uint8_t opcode);
   void op_cpl(uint8_t opcode);
   void op_scf(uint8_t opcode);
   void op_ccf(uint8_t opcode);
   void op_stop(uint8_t opcode);
+  void op_halt(uint8_t opcode);
+  void op_di(uint8_t opcode);
+  void op_ei(uint8_t opcode);
+
+  // CB prefixed
+  void op_prefix_cb(uint8_t opcode);
+
+  template <uint8_t opcode> void op_rotate_r(uint8_t);
+  template <uint8_t opcode> void op_bit_n_r(uint8_t);
+  template <uint8_t opcode> void op_res_n_r(uint8_t);
+  template <uint8_t opcode> void op_set_n_r(uint8_t);
+
+  // Indexed directly by the opcode byte. Built at compile time and shared by
+  // every `CPU` instance, the undefined opcodes trap into `op_illegal`.
+  static const std::array<opcode_method_t, 256> opcode_table;
+  static const std::array<opcode_method_t, 256> cb_opcode_table;
+
+#if defined(GAMERBOY_BLOCK_CACHE)
+  // Cached interpreter, straight-line runs of instructions are decoded once
+  // and replayed from `m_blocks` without fetching them from memory again.
+  struct DecodedInstruction {
+    opcode_method_t handler;
+    uint16_t immediate;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t cycles;
+    bool prefixed;
+  };
 
-  // clang-format off
-  std::map<uint8_t, opcode_method_t> opcode_map{
-      {0x00, &CPU::op_nop},
-      {0x01, &CPU::op_ld_rr_d16},
-      {0x02, &CPU::op_ld_drr_a},
-      {0x03, &CPU::op_inc_rr},
-      {0x04, &CPU::op_inc_hr},
-      {0x05, &CPU::op_dec_hr},
-      {0x06, &CPU::op_ld_hr_d8},
-      {0x07, &CPU::op_rlca},
-      {0x08, &CPU::op_ld_da16_sp},
-      {0x09, &CPU::op_add_hl_rr},
-      {0x0A, &CPU::op_ld_a_drr},
-      {0x0B, &CPU::op_dec_rr},
-      {0x0C, &CPU::op_inc_lr},
-      {0x0D, &CPU::op_dec_lr},
-      {0x0E, &CPU::op_ld_lr_d8},
-      {0x0F, &CPU::op_rrca},
-
-      {0x10, &CPU::op_stop},
-      {0x11, &CPU::op_ld_rr_d16},
-      {0x12, &CPU::op_ld_drr_a},
-      {0x13, &CPU::op_inc_rr},
-      {0x14, &CPU::op_inc_hr},
-      {0x15, &CPU::op_dec_hr},
-      {0x16, &CPU::op_ld_hr_d8},
-      {0x17, &CPU::op_rla},
-      {0x18, &CPU::op_jr_r8},
-      {0x19, &CPU::op_add_hl_rr},
-      {0x1A, &CPU::op_ld_a_drr},
-      {0x1B, &CPU::op_dec_rr},
-      {0x1C, &CPU::op_inc_lr},
-      {0x1D, &CPU::op_dec_lr},
-      {0x1E, &CPU::op_ld_lr_d8},
-      {0x1F, &CPU::op_rra},
-
-      {0x20, &CPU::op_jr_cc_r8},
-      {0x21, &CPU::op_ld_rr_d16},
-      {0x22, &CPU::op_ld_dhli_a},
-      {0x23, &CPU::op_inc_rr},
-      {0x24, &CPU::op_inc_hr},
-      {0x25, &CPU::op_dec_hr},
-      {0x26, &CPU::op_ld_hr_d8},
-      {0x27, &CPU::op_daa},
-      {0x28, &CPU::op_jr_cc_r8},
-      {0x29, &CPU::op_add_hl_rr},
-      {0x2A, &CPU::op_ld_a_dhli},
-      {0x2B, &CPU::op_dec_rr},
-      {0x2C, &CPU::op_inc_lr},
-      {0x2D, &CPU::op_dec_lr},
-      {0x2E, &CPU::op_ld_lr_d8},
-      {0x2F, &CPU::op_cpl},
-
-      {0x30, &CPU::op_jr_cc_r8},
-      {0x31, &CPU::op_ld_rr_d16},
-      {0x32, &CPU::op_ld_dhld_a},
-      {0x33, &CPU::op_inc_rr},
-      {0x34, &CPU::op_inc_dhl},
-      {0x35, &CPU::op_dec_dhl},
-      {0x36, &CPU::op_ld_dhl_d8},
-      {0x37, &CPU::op_scf},
-      {0x38, &CPU::op_jr_cc_r8},
-      {0x39, &CPU::op_add_hl_rr},
-      {0x3A, &CPU::op_ld_a_dhld},
-      {0x3B, &CPU::op_dec_rr},
-      {0x3C, &CPU::op_inc_hr},
-      {0x3D, &CPU::op_dec_hr},
-      {0x3E, &CPU::op_ld_hr_d8},
-      {0x3F, &CPU::op_ccf},
-
-      {0x40, &CPU::op_nop},
-
-      // TODO: Think of a way to simplify these load instructions,
-      //       the new way should be generic enough so all simple load
-      //       instructions can use it.
-      {0x41, &CPU::op_ld_b_c},
-      {0x42, &CPU::op_ld_b_d},
-      {0x43, &CPU::op_ld_b_e},
-      {0x44, &CPU::op_ld_b_h},
-      {0x45, &CPU::op_ld_b_l},
-      {0x46, &CPU::op_ld_b_dhl},
-      {0x47, &CPU::op_ld_b_a},
-
-      {0x48, &CPU::op_ld_c_b},
-      {0x49, &CPU::op_nop},
-      {0x4a, &CPU::op_ld_c_d},
-      {0x4b, &CPU::op_ld_c_e},
-      {0x4c, &CPU::op_ld_c_h},
-      {0x4d, &CPU::op_ld_c_l},
-      {0x4e, &CPU::op_ld_c_dhl},
-      {0x4f, &CPU::op_ld_c_a},
-
-      {0x50, &CPU::op_ld_d_b},
-      {0x51, &CPU::op_ld_d_c},
-      {0x52, &CPU::op_nop},
-      {0x53, &CPU::op_ld_d_e},
-      {0x54, &CPU::op_ld_d_h},
-      {0x55, &CPU::op_ld_d_l},
-      {0x56, &CPU::op_ld_d_dhl},
-      {0x57, &CPU::op_ld_d_a},
-
-      {0x58, &CPU::op_ld_e_b},
-      {0x59, &CPU::op_ld_e_c},
-      {0x5A, &CPU::op_ld_e_d},
-      {0x5B, &CPU::op_nop},
-      {0x5C, &CPU::op_ld_e_h},
-      {0x5D, &CPU::op_ld_e_l},
-      {0x5E, &CPU::op_ld_e_dhl},
-      {0x5F, &CPU::op_ld_e_a},
-
-      {0x60, &CPU::op_ld_h_b},
-      {0x61, &CPU::op_ld_h_c},
-      {0x62, &CPU::op_ld_h_d},
-      {0x63, &CPU::op_ld_h_e},
-      {0x64, &CPU::op_nop},
-      {0x65, &CPU::op_ld_h_l},
-      {0x66, &CPU::op_ld_h_dhl},
-      {0x67, &CPU::op_ld_h_a},
-
-      {0x68, &CPU::op_ld_l_b},
-      {0x69, &CPU::op_ld_l_c},
-      {0x6A, &CPU::op_ld_l_d},
-      {0x6B, &CPU::op_ld_l_e},
-      {0x6C, &CPU::op_ld_l_h},
-      {0x6D, &CPU::op_nop},
-      {0x6E, &CPU::op_ld_l_dhl},
-      {0x6F, &CPU::op_ld_l_a},
-
-      {0x70, &CPU::op_ld_dhl_b},
-      {0x71, &CPU::op_ld_dhl_c},
-      {0x72, &CPU::op_ld_dhl_d},
-      {0x73, &CPU::op_ld_dhl_e},
-      {0x74, &CPU::op_ld_dhl_h},
-      {0x75, &CPU::op_ld_dhl_l},
-      {0x76, &CPU::op_nop},
-      {0x77, &CPU::op_ld_dhl_a},
-
-      {0x78, &CPU::op_ld_a_b},
-      {0x79, &CPU::op_ld_a_c},
-      {0x7A, &CPU::op_ld_a_d},
-      {0x7B, &CPU::op_ld_a_e},
-      {0x7C, &CPU::op_ld_a_h},
-      {0x7D, &CPU::op_ld_a_l},
-      {0x7E, &CPU::op_ld_a_dhl},
-      {0x7F, &CPU::op_nop},
-
-      {0x80, &CPU::op_add_a_b},
-      {0x81, &CPU::op_add_a_c},
-      {0x82, &CPU::op_add_a_d},
-      {0x83, &CPU::op_add_a_e},
-      {0x84, &CPU::op_add_a_h},
-      {0x85, &CPU::op_add_a_l},
-      {0x86, &CPU::op_add_a_dhl},
-      {0x87, &CPU::op_add_a_a},
-
-      {0x88, &CPU::op_adc_a_b},
-      {0x89, &CPU::op_adc_a_c},
-      {0x8A, &CPU::op_adc_a_d},
-      {0x8B, &CPU::op_adc_a_e},
-      {0x8C, &CPU::op_adc_a_h},
-      {0x8D, &CPU::op_adc_a_l},
-      {0x8E, &CPU::op_adc_a_dhl},
-      {0x8F, &CPU::op_adc_a_a},
-
-      {0x90, &CPU::op_sub_a_b},
-      {0x91, &CPU::op_sub_a_c},
-      {0x92, &CPU::op_sub_a_d},
-      {0x93, &CPU::op_sub_a_e},
-      {0x94, &CPU::op_sub_a_h},
-      {0x95, &CPU::op_sub_a_l},
-      {0x96, &CPU::op_sub_a_dhl},
-      {0x97, &CPU::op_sub_a_a},
-
-      {0x98, &CPU::op_sbc_a_b},
-      {0x99, &CPU::op_sbc_a_c},
-      {0x9A, &CPU::op_sbc_a_d},
-      {0x9B, &CPU::op_sbc_a_e},
-      {0x9C, &CPU::op_sbc_a_h},
-      {0x9D, &CPU::op_sbc_a_l},
-      {0x9E, &CPU::op_sbc_a_dhl},
-      {0x9F, &CPU::op_sbc_a_a},
-
-      {0xA0, &CPU::op_and_a_b},
-      {0xA1, &CPU::op_and_a_c},
-      {0xA2, &CPU::op_and_a_d},
-      {0xA3, &CPU::op_and_a_e},
-      {0xA4, &CPU::op_and_a_h},
-      {0xA5, &CPU::op_and_a_l},
-      {0xA6, &CPU::op_and_a_dhl},
-      {0xA7, &CPU::op_and_a_a},
-
-      {0xA8, &CPU::op_xor_a_b},
-      {0xA9, &CPU::op_xor_a_c},
-      {0xAA, &CPU::op_xor_a_d},
-      {0xAB, &CPU::op_xor_a_e},
-      {0xAC, &CPU::op_xor_a_h},
-      {0xAD, &CPU::op_xor_a_l},
-      {0xAE, &CPU::op_xor_a_dhl},
-      {0xAF, &CPU::op_xor_a_a},
-
-      {0xB0, &CPU::op_or_a_b},
-      {0xB1, &CPU::op_or_a_c},
-      {0xB2, &CPU::op_or_a_d},
-      {0xB3, &CPU::op_or_a_e},
-      {0xB4, &CPU::op_or_a_h},
-      {0xB5, &CPU::op_or_a_l},
-      {0xB6, &CPU::op_or_a_dhl},
-      {0xB7, &CPU::op_or_a_a},
-
-      {0xB8, &CPU::op_cp_a_b},
-      {0xB9, &CPU::op_cp_a_c},
-      {0xBA, &CPU::op_cp_a_d},
-      {0xBB, &CPU::op_cp_a_e},
-      {0xBC, &CPU::op_cp_a_h},
-      {0xBD, &CPU::op_cp_a_l},
-      {0xBE, &CPU::op_cp_a_dhl},
-      {0xBF, &CPU::op_cp_a_a},
-
-      {0xE0, &CPU::op_ld_da8_a},
+  struct Block {
+    std::vector<DecodedInstruction> instructions;
+#if defined(GAMERBOY_JIT)
+    // Address after the last instruction, and the most cycles a run of the
+    // block can take.
+    uint16_t end = 0;
+    uint16_t max_cycles = 0;
+    uint32_t executions = 0;
+    native_block_t native = nullptr;
+    // Whether the last instruction was recompiled, the interpreter updates
+    // `m_registers.pc` for the rest.
+    bool native_tail = false;
+#endif
+#if defined(GAMERBOY_IDLE_SKIP)
+    // Polls memory in a loop, see `is_idle_loop`.
+    bool idle = false;
+#endif
   };
-  // clang-format on
+
+  Block *get_block(uint16_t address);
+  Block decode_block(uint16_t address);
+  void invalidate_ram_blocks();
+#if defined(GAMERBOY_IDLE_SKIP)
+  static bool is_idle_loop(const Block &block, uint16_t address);
+  // Cycles into the batch the idle loop at `block` can skip to, after a pass
+  // that ran from `start` to `elapsed` cycles in.
+  uint64_t skip_idle_loop(const Block &block, uint64_t start,
+                          uint64_t elapsed);
+#endif
+
+  // Keyed by the ROM bank mapped at the start address, and the address.
+  std::unordered_map<uint32_t, Block> m_blocks;
+
+  // WRAM and HRAM bytes that belong to a cached block.
+  std::bitset<0x10000> m_ram_code;
+  bool m_ram_code_written = false;
+#endif
+
+#if defined(GAMERBOY_BLOCK_CACHE) || defined(GAMERBOY_AOT)
+  // Set when the running block has to stop early.
+  bool m_exit_block = false;
+#endif
+
+#if defined(GAMERBOY_AOT)
+  // Ahead of time translated ROM, see `aot.h`. Only used when the loaded
+  // cartridge is the one it was generated from.
+  friend struct Aot;
+  bool m_aot_enabled = false;
+
+  // Checks translated blocks against the interpreter, see
+  // `tests/aot_test.cc`.
+  friend struct AotTest;
+#endif
+
+#if defined(GAMERBOY_JIT)
+  // x86-64 recompiler on top of the cached interpreter, see `jit.cc`. Hot
+  // ROM blocks are translated to native code, everything the recompiler
+  // doesn't handle calls back into the interpreter handlers.
+  native_block_t compile_block(Block &block, uint16_t address);
+  void flush_native_blocks();
+  static int32_t jit_interpret(CPU *cpu, const DecodedInstruction *instruction,
+                               uint16_t next_pc, int32_t block_cycles);
+
+  X64Emitter m_jit{16 * 1024 * 1024};
+
+  // Checks recompiled blocks against the interpreter, see
+  // `tests/jit_test.cc`.
+  friend struct JitTest;
+#endif
+
+#if defined(GAMERBOY_THREADED_DISPATCH) && defined(__clang__)
+  // Threaded engine, every handler tail calls the handler of the next
+  // opcode so each one gets its own indirect branch.
+  typedef uint64_t (*threaded_handler_t)(CPU &, uint64_t);
+
+  template <uint8_t opcode>
+  static uint64_t threaded_handler(CPU &cpu, uint64_t elapsed);
+  template <uint8_t opcode>
+  static uint64_t threaded_cb_handler(CPU &cpu, uint64_t elapsed);
+
+  static const std::array<threaded_handler_t, 256> threaded_table;
+  static const std::array<threaded_handler_t, 256> threaded_cb_table;
+#endif
 };
+
+constexpr uint8_t CPU::compute_flags(FlagOperation operation, uint8_t a,
+                                     uint8_t value, uint16_t result) {
+  uint8_t f = 0;
+  if ((result & 0xFF) == 0)
+    f |= Flags::ZERO_FLAG;
+  if (operation == FlagOperation::SUB)
+    f |= Flags::SUBTRACT_FLAG;
+  // Bit 4 of the result is only flipped by a carry out of the low nibble.
+  if (operation == FlagOperation::AND || ((a ^ value ^ result) & 0x10))
+    f |= Flags::HALF_CARRY_FLAG;
+  if (result & 0x100)
+    f |= Flags::CARRY_FLAG;
+  return f;
+}
+
+inline uint8_t CPU::get_flags() {
+#if defined(GAMERBOY_LAZY_FLAGS)
+  if (m_registers.flag_operation != FlagOperation::NONE) {
+    m_registers[Registers::AF].set_lower_register(
+        compute_flags(m_registers.flag_operation, m_registers.flag_a,
+                      m_registers.flag_value, m_registers.flag_result));
+    m_registers.flag_operation = FlagOperation::NONE;
+  }
+#endif
+  return m_registers[Registers::AF].get_lower_register();
+}
+
+inline bool CPU::get_zero() {
+#if defined(GAMERBOY_LAZY_FLAGS)
+  if (m_registers.flag_operation != FlagOperation::NONE)
+    return (m_registers.flag_result & 0xFF) == 0;
+#endif
+  return m_registers[Registers::AF].get_lower_register() & Flags::ZERO_FLAG;
+}
+
+inline bool CPU::get_carry() {
+#if defined(GAMERBOY_LAZY_FLAGS)
+  if (m_registers.flag_operation != FlagOperation::NONE)
+    return m_registers.flag_result & 0x100;
+#endif
+  return m_registers[Registers::AF].get_lower_register() & Flags::CARRY_FLAG;
+}
+
+inline void CPU::set_flags(uint8_t flags) {
+#if defined(GAMERBOY_LAZY_FLAGS)
+  m_registers.flag_operation = FlagOperation::NONE;
+#endif
+  m_registers[Registers::AF].set_lower_register(flags);
+}
+
+inline void CPU::set_flag(uint8_t flag, bool set) {
+  get_flags();
+  m_registers[Registers::AF].set_flag(flag, set);
+}
+
+inline void CPU::set_alu_flags(FlagOperation operation, uint8_t a,
+                               uint8_t value, uint16_t result) {
+#if defined(GAMERBOY_LAZY_FLAGS)
+  m_registers.flag_operation = operation;
+  m_registers.flag_a = a;
+  m_registers.flag_value = value;
+  m_registers.flag_result = result;
+#else
+  m_registers[Registers::AF].set_lower_register(
+      compute_flags(operation, a, value, result));
+#endif
+}
+
+// In the header so the ahead of time translated code can inline it too.
+template <uint8_t operation> void CPU::alu_a_r(uint8_t value) {
+  if constexpr (operation == 0)
+    add_a_r(value);
+  else if constexpr (operation == 1)
+    adc_a_r(value);
+  else if constexpr (operation == 2)
+    sub_a_r(value);
+  else if constexpr (operation == 3)
+    sbc_a_r(value);
+  else if constexpr (operation == 4)
+    and_a_r(value);
+  else if constexpr (operation == 5)
+    xor_a_r(value);
+  else if constexpr (operation == 6)
+    or_a_r(value);
+  else
+    cp_a_r(value);
+}
+
 } // namespace gb
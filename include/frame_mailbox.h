@@ -0,0 +1,69 @@
+#pragma once
+
+#include "line_renderer.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+// Memory a frame is drawn into, ARGB8888 rows `pitch` bytes apart.
+struct FrameTarget {
+  uint32_t *pixels = nullptr;
+  std::size_t pitch = 0;
+};
+
+// Three frames passed from the thread drawing them to the one showing them,
+// without either ever waiting on the other. The drawing side always has a
+// frame of its own to draw into, the showing side gets the newest finished
+// one and frames it never got to are dropped.
+//
+// The mailbox only passes the memory around, the showing side owns it. That
+// lets frames be drawn straight into locked textures.
+class FrameMailbox {
+public:
+  // The back and middle frames, the front one starts out with nothing.
+  FrameMailbox(FrameTarget back, FrameTarget middle)
+      : m_targets{back, middle, FrameTarget{}} {}
+
+  // Drawing thread. The frame it's drawing into.
+  const FrameTarget &get_back() const { return m_targets[m_back]; }
+  // Drawing thread. The back frame is finished, it swaps with the one in the
+  // middle.
+  void publish() {
+    m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) &
+             INDEX_MASK;
+  }
+
+  // Showing thread. Whether a frame was published since the last `take`.
+  bool has_fresh() const {
+    // Only the showing thread clears the bit, it stays set until `take`.
+    return m_middle.load(std::memory_order_relaxed) & FRESH;
+  }
+  // Showing thread. Index of the frame being shown, 0 to 2.
+  std::size_t get_front() const { return m_front; }
+  // Showing thread. Points the front frame at other memory, before `take`
+  // hands it back to be drawn into.
+  void set_front(FrameTarget target) { m_targets[m_front] = target; }
+  // Showing thread. Swaps the front frame with the newest published one and
+  // returns its index, only when `has_fresh`.
+  std::size_t take() {
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) &
+              INDEX_MASK;
+    return m_front;
+  }
+
+private:
+  static constexpr uint8_t INDEX_MASK = 0x03;
+  // The middle frame was published and hasn't been taken yet.
+  static constexpr uint8_t FRESH = 0x04;
+
+  std::array<FrameTarget, 3> m_targets;
+  uint8_t m_back = 0;
+  std::atomic<uint8_t> m_middle = 1;
+  uint8_t m_front = 2;
+};
+
+} // namespace gb
@@ -2,44 +2,79 @@
 
 #include "cartridge.h"
 #include "cpu.h"
+#include "frame_mailbox.h"
 #include "memory.h"
 #include "ppu.h"
+#include "scheduler.h"
+#include "timer.h"
 
+#include <chrono>
 #include <cstddef>
 #include <filesystem>
+#include <stop_token>
 #include <vector>
 
 namespace gb {
+
+// Machine cycle the boot ROM hands over to the cartridge at. It runs for much
+// longer, this only keeps the part DIV shows so it reads 0xAB like it does on
+// a DMG.
+constexpr uint64_t BOOT_END_CYCLE = 0xABCC / 4;
+
+// Clock cycles a second.
+constexpr uint64_t CLOCK_SPEED = 4194304;
+// How long a frame takes on a DMG, a bit under 60 a second.
+constexpr std::chrono::nanoseconds FRAME_DURATION{
+    uint64_t{FRAME_CYCLES} * 1'000'000'000 / CLOCK_SPEED};
+
+struct BootOptions {
+  // Start at 0x0100 in the state the boot ROM leaves behind, instead of
+  // running it.
+  bool skip = false;
+  // Refuse cartridges whose logo or header checksum Nintendo's boot ROM would
+  // lock up on.
+  bool check_header = false;
+};
+
 class Gameboy {
 public:
-  Gameboy(const char *path);
-  ~Gameboy();
+  // Frames are drawn into `frames`, which has to outlive the emulator.
+  Gameboy(const char *path, FrameMailbox &frames, BootOptions boot = {});
 
-  void on();
+  // Runs at the speed of a DMG until `stop` is requested, drawing frames
+  // into the mailbox.
+  void emulate(std::stop_token stop);
 
   CPU &get_cpu() { return m_cpu; }
   Memory &get_memory() { return m_mem; }
-  NoMbc &get_cartridge() { return m_cartridge; }
+  Cartridge &get_cartridge() { return m_cartridge; }
+  PPU &get_ppu() { return m_ppu; }
+  Timer &get_timer() { return m_timer; }
+  FrameMailbox &get_frames() { return m_frames; }
+  Scheduler &get_scheduler() { return m_scheduler; }
 
-private:
-  inline bool did_quit() { return m_did_close; }
+  // Machine cycles since power on. While the CPU runs this is where its
+  // current instruction started.
+  uint64_t get_cycles() const { return m_cpu.get_cycles(); }
+
+  // Schedules `event` at `cycle`. When that is before the running CPU batch
+  // would end, the batch ends early.
+  void schedule(Event event, uint64_t cycle);
 
+private:
   void run();
-  void process();
+  void handle(const ScheduledEvent &event);
 
-  bool m_did_close = false;
-  uint64_t m_cycles = 0;
+  bool m_frame_done = false;
   std::filesystem::path m_rom_path = "";
-  std::vector<std::byte> m_rom_data = {};
+  utility::MappedFile m_rom_file;
 
-  // TODO: This should be the generic `gb::Cartridge` class.
-  NoMbc m_cartridge;
+  Cartridge m_cartridge;
+  FrameMailbox &m_frames;
+  Scheduler m_scheduler;
   CPU m_cpu;
   Memory m_mem;
   PPU m_ppu;
-
-  utility::sdl_window_ptr m_window = {nullptr, SDL_DestroyWindow};
-  utility::sdl_renderer_ptr m_renderer = {nullptr, SDL_DestroyRenderer};
-  utility::sdl_texture_ptr m_texture = {nullptr, SDL_DestroyTexture};
+  Timer m_timer;
 };
 } // namespace gb
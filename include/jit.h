@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+// x86-64 general purpose registers, in encoding order.
+enum class X64 : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// The `/digit` of the x86 group 1 instructions.
+enum class X64Alu : uint8_t {
+  ADD,
+  OR,
+  ADC,
+  SBB,
+  AND,
+  SUB,
+  XOR,
+  CMP,
+};
+
+enum class X64Condition : uint8_t {
+  CARRY = 0x2,
+  ZERO = 0x4,
+  SIGN = 0x8,
+};
+
+// Emits x86-64 machine code into an executable buffer for the recompiler.
+// Only the handful of instruction forms it needs are supported, registers are
+// 32-bit unless the method says otherwise.
+class X64Emitter {
+public:
+  X64Emitter(std::size_t size);
+  ~X64Emitter();
+
+  X64Emitter(const X64Emitter &) = delete;
+  X64Emitter &operator=(const X64Emitter &) = delete;
+
+  // Makes the buffer writable, returns where the next function starts.
+  uint8_t *begin();
+  // Makes the buffer executable again.
+  void end();
+
+  // Whether there is room left for a function of `size` bytes.
+  bool has_room(std::size_t size) const { return m_used + size <= m_size; }
+  // Throws away everything emitted so far.
+  void reset() { m_used = 0; }
+
+  void mov(X64 dst, X64 src);
+  void mov(X64 dst, uint32_t imm);
+  void mov64(X64 dst, X64 src);
+  void mov64(X64 dst, uint64_t imm);
+  void movzx8(X64 dst, X64 src);
+  void movzx16(X64 dst, X64 src);
+
+  // movzx dst, word [base+disp] / mov word [base+disp], src
+  void load16(X64 dst, X64 base, int8_t disp);
+  void store16(X64 base, int8_t disp, X64 src);
+
+  void alu(X64Alu op, X64 dst, X64 src);
+  void alu(X64Alu op, X64 dst, uint32_t imm);
+  void alu8(X64Alu op, X64 dst, X64 src);
+  void test8(X64 reg, uint8_t imm);
+  void bt(X64 reg, uint8_t bit);
+  void setcc(X64Condition condition, X64 dst);
+
+  void shl(X64 reg, uint8_t count);
+  void shr(X64 reg, uint8_t count);
+
+  // dword [rsp] is used as a local.
+  void store_local(uint32_t imm);
+  void load_local(X64 dst);
+  void add_local(uint32_t imm);
+  void add_local(X64 src);
+
+  void push(X64 reg);
+  void pop(X64 reg);
+  void add_rsp(uint8_t imm);
+  void sub_rsp(uint8_t imm);
+  void call(X64 reg);
+  void ret();
+
+  // Forward jumps, `bind` patches the returned displacement to point at the
+  // current position.
+  uint8_t *jcc(X64Condition condition);
+  void bind(uint8_t *displacement);
+
+private:
+  void emit(uint8_t byte) { m_code[m_used++] = byte; }
+  void emit32(uint32_t value);
+  void emit64(uint64_t value);
+  void rex(bool wide, uint8_t reg, uint8_t rm, bool byte_operands = false);
+  void modrm(uint8_t mod, uint8_t reg, uint8_t rm);
+
+  uint8_t *m_code = nullptr;
+  std::size_t m_size = 0;
+  std::size_t m_used = 0;
+  std::size_t m_function = 0;
+};
+
+} // namespace gb
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "compositor.h"
+#include "memory.h"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+constexpr uint8_t SCREEN_WIDTH = 160;
+constexpr uint8_t SCREEN_HEIGHT = 144;
+
+// The 384 tiles at 0x8000-0x97FF decoded from 2 bit planes to a color number
+// a byte, and mirrored for sprites. Tiles are drawn far more often than
+// they're written, one is only decoded again after a write to its 16 bytes.
+class TileCache {
+public:
+  static constexpr std::size_t TILE_COUNT = 0x180;
+
+  TileCache(const uint8_t *vram) : m_vram(vram) { m_dirty.set(); }
+
+  void invalidate(uint16_t tile) { m_dirty[tile] = true; }
+
+  // The 8 pixels of `row` in `tile`, right to left when `flip`.
+  const uint8_t *get_row(uint16_t tile, uint8_t row, bool flip) {
+    if (m_dirty[tile])
+      decode(tile);
+    return (flip ? m_flipped : m_tiles)[tile].data() + row * 8;
+  }
+
+private:
+  void decode(uint16_t tile);
+
+  const uint8_t *m_vram;
+  std::array<std::array<uint8_t, 64>, TILE_COUNT> m_tiles;
+  std::array<std::array<uint8_t, 64>, TILE_COUNT> m_flipped;
+  std::bitset<TILE_COUNT> m_dirty;
+};
+
+// What lines are drawn from: VRAM, OAM and the I/O registers by their offset
+// from 0xFF00.
+struct VideoMemory {
+  const uint8_t *vram;
+  const uint8_t *oam;
+  const uint8_t *io;
+};
+
+// Draws whole lines into a frame from whatever `VideoMemory` holds when
+// they're drawn, it doesn't know anything about timing.
+class LineRenderer {
+public:
+  LineRenderer(VideoMemory memory)
+      : m_memory(memory), m_tiles(m_memory.vram) {}
+
+  // Where lines go, rows `pitch` bytes apart.
+  void set_target(uint32_t *pixels, std::size_t pitch) {
+    m_target = pixels;
+    m_pitch = pitch / sizeof(uint32_t);
+  }
+
+  // The window starts from its top again.
+  void start_frame() { m_window_line = 0; }
+  void draw_line(uint8_t line);
+  // Fills the target white, what the LCD shows while it's off.
+  void clear();
+
+  // After `value` was written to `address`, in VRAM, OAM or a register lines
+  // are drawn from.
+  void write(uint16_t address, uint8_t value) {
+    if (address >= 0x8000 && address < 0x8000 + TileCache::TILE_COUNT * 16)
+      m_tiles.invalidate((address - 0x8000) >> 4);
+  }
+
+private:
+  uint8_t get_io(uint8_t reg) const { return m_memory.io[reg]; }
+
+  void draw_background(uint8_t line, uint8_t *colors);
+  void draw_window(uint8_t line, uint8_t *colors);
+  void draw_sprites(uint8_t line, uint8_t *colors, uint8_t *flags);
+
+  VideoMemory m_memory;
+  TileCache m_tiles;
+  compositor_t m_composite = get_compositor();
+  // The window has its own line counter, it only counts lines it's shown on.
+  uint8_t m_window_line = 0;
+
+  uint32_t *m_target = nullptr;
+  // In pixels.
+  std::size_t m_pitch = SCREEN_WIDTH;
+};
+
+} // namespace gb
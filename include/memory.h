@@ -1,49 +1,154 @@
 #pragma once
 
+#include "boot_rom.h"
 #include "cartridge.h"
+#include "scheduler.h"
 #include "utility.h"
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
-#include <map>
-#include <utility>
 
 namespace gb {
 
 class Gameboy;
 
+// Stands in for the ROM bank while the boot rom is mapped over 0x0000-0x00FF.
+constexpr uint16_t BOOT_ROM_BANK = 0xFFFF;
+
+// An OAM DMA transfer copies a byte every machine cycle.
+constexpr uint64_t OAM_DMA_CYCLES = 0xA0;
+
+// I/O registers, by their offset from 0xFF00.
+enum IoRegisters : uint8_t {
+  JOYPAD = 0x00,
+  SERIAL_DATA = 0x01,
+  SERIAL_CONTROL = 0x02,
+  DIVIDER = 0x04,
+  TIMER_COUNTER = 0x05,
+  TIMER_MODULO = 0x06,
+  TIMER_CONTROL = 0x07,
+  INTERRUPT_FLAG = 0x0F,
+  SOUND_1_LENGTH = 0x11,
+  SOUND_1_ENVELOPE = 0x12,
+  SOUND_1_FREQUENCY_LOW = 0x13,
+  SOUND_1_FREQUENCY_HIGH = 0x14,
+  SOUND_VOLUME = 0x24,
+  SOUND_PANNING = 0x25,
+  SOUND_ON = 0x26,
+  LCD_CONTROL = 0x40,
+  LCD_STATUS = 0x41,
+  SCROLL_Y = 0x42,
+  SCROLL_X = 0x43,
+  LINE_Y = 0x44,
+  LINE_Y_COMPARE = 0x45,
+  OAM_DMA = 0x46,
+  BACKGROUND_PALETTE = 0x47,
+  OBJECT_PALETTE_0 = 0x48,
+  OBJECT_PALETTE_1 = 0x49,
+  WINDOW_Y = 0x4A,
+  WINDOW_X = 0x4B,
+  BOOT_ROM_DISABLE = 0x50,
+  INTERRUPT_ENABLE = 0xFF,
+};
+
 class Memory {
 public:
   Memory(Gameboy &gb);
 
-  uint8_t read_memory(uint16_t addr);
-  void write_memory(uint16_t addr, uint8_t value);
+  // Pages backed by host memory are a single load, the rest go through their
+  // handler. 0xFF00-0xFFFF goes through `IO_REGISTERS` instead.
+  uint8_t read_memory(uint16_t addr) {
+    if (const uint8_t *page = m_read_pages[addr >> 8])
+      return page[addr & 0xFF];
+    if (addr >= 0xFF00)
+      return read_io(addr & 0xFF);
+    return (this->*m_read_handlers[addr >> 8])(addr);
+  }
+
+  void write_memory(uint16_t addr, uint8_t value) {
+    if (uint8_t *page = m_write_pages[addr >> 8])
+      page[addr & 0xFF] = value;
+    else if (addr >= 0xFF00)
+      write_io(addr & 0xFF, value);
+    else
+      (this->*m_write_handlers[addr >> 8])(addr, value);
+  }
+
+  const uint8_t *get_vram() const { return m_vram.data(); }
+  const uint8_t *get_oam() const { return m_oam.data(); }
+  const uint8_t *get_io_data() const { return m_io.data(); }
+
+  // Backing byte of I/O register `reg`, for the subsystems that own one with
+  // side effects. Bits that always read as 1 aren't kept.
+  uint8_t get_io(uint8_t reg) const { return m_io[reg]; }
+  void set_io(uint8_t reg, uint8_t value) { m_io[reg] = value; }
+
+  // ROM bank currently mapped at `addr`, 0 outside of ROM.
+  uint16_t get_rom_bank(uint16_t addr);
+
+  // Machine cycle after `cycle` the value at `addr` can next change at
+  // without a write or an event, `NEVER` for anything else.
+  uint64_t next_change(uint16_t addr, uint64_t cycle);
+
+  // Puts VRAM and the I/O registers in the state the boot ROM leaves them in,
+  // and unmaps it. Where the LCD is in its frame is up to `PPU::skip_boot`.
+  void skip_boot();
+
+  // Handles `Event::OAM_DMA_END`.
+  void end_oam_dma() { m_oam_dma = false; }
 
 private:
   Gameboy &m_gb;
-  NoMbc &m_cartridge;
+  Cartridge &m_cartridge;
 
   // Gameboys have a 8192 bytes of ram.
-  std::array<uint8_t, 0x2000> m_ram;
+  std::array<uint8_t, 0x2000> m_ram{};
+  std::array<uint8_t, 0x2000> m_vram{};
+  std::array<uint8_t, 0xA0> m_oam{};
+  // I/O registers and HRAM, IE is kept by the CPU.
+  std::array<uint8_t, 0x100> m_io{};
 
-  // The boot rom only has 255 bytes.
-  std::vector<std::byte> m_boot_rom;
+  // The boot rom covers the first page, `DMG_BOOT_ROM` is generated from
+  // `GAMERBOY_BOOT_ROM` at build time.
+  static_assert(DMG_BOOT_ROM.size() == 0x100, "The boot rom is 256 bytes");
 
   bool m_boot_rom_disabled = false;
+  // OAM is locked while a DMA transfer runs, reads are 0xFF and writes are
+  // dropped.
+  bool m_oam_dma = false;
   inline bool is_boot_rom_disabled() { return m_boot_rom_disabled; };
 
-  // using memory_method_t = std::function<uint8_t(Memory &, uint8_t)>;
   typedef uint8_t (Memory::*memory_read_method_t)(uint16_t);
   typedef void (Memory::*memory_write_method_t)(uint16_t, uint8_t);
 
-  uint8_t read_rom(uint16_t addr);
-  uint8_t read_mbc_rom(uint16_t addr);
-  uint8_t read_vram(uint16_t addr);
-  uint8_t read_mbc_ram(uint16_t addr);
-  uint8_t read_ram(uint16_t addr);
-  uint8_t read_banked_ram(uint16_t addr);
-  uint8_t read_high_memory(uint16_t addr);
+  // An I/O register or HRAM byte. Without hooks it's just its byte in
+  // `m_io`, the hooks are for the ones with side effects and get the value
+  // already masked.
+  struct IoRegister {
+    // Bits that always read as 1.
+    uint8_t unused = 0xFF;
+    // Bits writes change.
+    uint8_t writable = 0x00;
+    uint8_t (*read)(Memory &) = nullptr;
+    void (*write)(Memory &, uint8_t) = nullptr;
+  };
+
+  // By the low byte of the address.
+  static const std::array<IoRegister, 0x100> IO_REGISTERS;
+
+  uint8_t read_io(uint8_t reg) {
+    const IoRegister &io = IO_REGISTERS[reg];
+    return (io.read != nullptr ? io.read(*this) : m_io[reg]) | io.unused;
+  }
+
+  void write_io(uint8_t reg, uint8_t value) {
+    const IoRegister &io = IO_REGISTERS[reg];
+    if (io.write != nullptr)
+      io.write(*this, value & io.writable);
+    else
+      m_io[reg] = value & io.writable;
+  }
 
   // Memory Map
   // clang-format off
@@ -60,50 +165,37 @@ private:
   // FF80	FFFE	High RAM (HRAM)
   // clang-format on
 
-  std::map<utility::Mask, memory_read_method_t, std::less<>> m_read_map = {
-      {utility::Mask{0x0000, 0xF000}, &Memory::read_rom},
-      {utility::Mask{0x1000, 0xF000}, &Memory::read_rom},
-      {utility::Mask{0x2000, 0xF000}, &Memory::read_rom},
-      {utility::Mask{0x3000, 0xF000}, &Memory::read_rom},
-      {utility::Mask{0x4000, 0xF000}, &Memory::read_mbc_rom},
-      {utility::Mask{0x5000, 0xF000}, &Memory::read_mbc_rom},
-      {utility::Mask{0x6000, 0xF000}, &Memory::read_mbc_rom},
-      {utility::Mask{0x7000, 0xF000}, &Memory::read_mbc_rom},
-      {utility::Mask{0x8000, 0xF000}, &Memory::read_vram},
-      {utility::Mask{0x9000, 0xF000}, &Memory::read_vram},
-      {utility::Mask{0xA000, 0xF000}, &Memory::read_mbc_ram},
-      {utility::Mask{0xB000, 0xF000}, &Memory::read_mbc_ram},
-      {utility::Mask{0xC000, 0xF000}, &Memory::read_ram},
-      {utility::Mask{0xD000, 0xF000}, &Memory::read_banked_ram},
-      {utility::Mask{0xE000, 0xF000}, &Memory::read_ram},
-      {utility::Mask{0xF000, 0xF000}, &Memory::read_high_memory},
-  };
+  // One entry per 256 byte page, indexed by the top byte of the address.
+  // Plain ROM and RAM pages point straight at host memory, bank switches and
+  // mirrors just rewrite the pointers. A page without one goes through its
+  // handler, except for 0xFF which never has either.
+  std::array<const uint8_t *, 0x100> m_read_pages{};
+  std::array<uint8_t *, 0x100> m_write_pages{};
+  std::array<memory_read_method_t, 0x100> m_read_handlers{};
+  std::array<memory_write_method_t, 0x100> m_write_handlers{};
+
+  // Backs pages `first` through `last` with `data`, for reads and writes.
+  void map_ram(uint8_t first, uint8_t last, uint8_t *data);
+  // Points 0x0000-0x7FFF at the boot rom and the selected ROM banks.
+  void map_rom();
+  // Points 0xA000-0xBFFF at the selected cartridge RAM bank, if there is one.
+  void map_external_ram();
+
+  uint8_t read_open_bus(uint16_t addr);
+  uint8_t read_mbc_ram(uint16_t addr);
+  uint8_t read_oam(uint16_t addr);
 
   void write_mbc(uint16_t addr, uint8_t value);
-  void write_ram(uint16_t addr, uint8_t value);
   void write_mbc_ram(uint16_t addr, uint8_t value);
   void write_vram(uint16_t addr, uint8_t value);
-  void write_banked_ram(uint16_t addr, uint8_t value);
-  void write_high_memory(uint16_t addr, uint8_t value);
-
-  std::map<utility::Mask, memory_write_method_t, std::less<>> m_write_map = {
-      {utility::Mask{0x0000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x1000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x2000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x3000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x4000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x5000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x6000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x7000, 0xF000}, &Memory::write_mbc},
-      {utility::Mask{0x8000, 0xF000}, &Memory::write_vram},
-      {utility::Mask{0x9000, 0xF000}, &Memory::write_vram},
-      {utility::Mask{0xA000, 0xF000}, &Memory::write_mbc_ram},
-      {utility::Mask{0xB000, 0xF000}, &Memory::write_mbc_ram},
-      {utility::Mask{0xC000, 0xF000}, &Memory::write_ram},
-      {utility::Mask{0xD000, 0xF000}, &Memory::write_banked_ram},
-      {utility::Mask{0xE000, 0xF000}, &Memory::write_ram},
-      {utility::Mask{0xF000, 0xF000}, &Memory::write_high_memory},
-  };
+  void write_oam(uint16_t addr, uint8_t value);
+  // Plain registers the PPU draws from, lines up to now are drawn with the
+  // old value first.
+  template <uint8_t reg> static void write_video(Memory &mem, uint8_t value);
+
+  // Copies the 0xA0 bytes from `page` << 8 into OAM, locking it until
+  // `Event::OAM_DMA_END`.
+  void start_oam_dma(uint8_t page);
 };
 
 } // namespace gb
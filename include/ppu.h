@@ -1,8 +1,14 @@
 #pragma once
 
+#include "frame_mailbox.h"
+#include "line_renderer.h"
 #include "memory.h"
 #include "registers.h"
 
+#if defined(GAMERBOY_PARALLEL_PPU)
+#include "render_worker.h"
+#endif
+
 #include <cstdint>
 
 namespace gb {
@@ -36,31 +42,81 @@ constexpr uint32_t FRAME_CYCLES = 70224;
 
 class Gameboy;
 
+// Nothing ticks, where the PPU is in a frame follows from the machine cycles
+// since the LCD was turned on. LY and STAT catch up to the current cycle when
+// they're read, the only event is the VBlank interrupt. The other registers
+// are plain bytes in `Memory`.
+//
+// Lines are drawn whole, as mode 3 starts on them. That happens lazily too:
+// before anything they're drawn from changes, and at VBlank. With
+// `GAMERBOY_PARALLEL_PPU` they're only logged here and drawn on another
+// thread.
 class PPU {
 public:
   PPU(Gameboy &gb);
 
-  void cycle(uint64_t cycles);
+  bool is_enabled() { return m_mem.get_io(LCD_CONTROL) & 0x80; }
+
+  // Handles `Event::VBLANK`, due at machine cycle `cycle` when line 144
+  // starts, and schedules the next one.
+  void vblank(uint64_t cycle);
+
+  // Turning the LCD off stops the VBlank events, turning it back on starts a
+  // frame from the top.
+  void write_lcd_control(uint8_t value);
+  // Moves the running frame to where the boot ROM leaves it, after the LCD
+  // was turned on at machine cycle `cycle`.
+  void skip_boot(uint64_t cycle);
+
+  // The interrupt select bits written to STAT, with the mode and LY=LYC.
+  uint8_t read_lcd_status();
+  uint8_t read_line_y();
+
+  // Draws the lines that have started by now, before a write to VRAM, OAM or
+  // a register they're drawn from.
+  void catch_up();
+  // After `value` was written to `address`, in VRAM, OAM or a register lines
+  // are drawn from.
+  void write(uint16_t address, uint8_t value) {
+    m_renderer.write(address, value);
+  }
+
+  // Publishes the frame once it's drawn, at the end of a run. A frame with
+  // the LCD off all the way through is white.
+  void finish_frame();
+
+  // Machine cycle after `cycle` LY or the STAT mode can next change at,
+  // `NEVER` while the LCD is off.
+  uint64_t next_change(uint64_t cycle);
 
 private:
-  uint64_t m_current_cycle = 0;
-  VideoMode m_current_video_mode = VideoMode::ACCESS_OAM;
+  // Works out LY and the mode at machine cycle `cycle`.
+  void sync(uint64_t cycle);
+
+  // Draws every line mode 3 has started on by machine cycle `cycle`.
+  void render(uint64_t cycle);
+
+  VideoMode m_current_video_mode = VideoMode::HBLANK;
+  // Machine cycle the LCD was last turned on, the start of its first frame.
+  uint64_t m_enabled_cycle = 0;
+  // Machine cycle LY and the mode are up to date at.
+  uint64_t m_synced_cycle = 0;
 
   Gameboy &m_gb;
   Memory &m_mem;
 
-  Register m_lcd_control;
-  Register m_lcd_status;
-  Register m_scroll_y;
-  Register m_scroll_x;
   Register m_line_y;
-  Register m_line_y_compare;
-  Register m_direct_mem_access;
-  Register m_backgroud_palette;
-  Register m_object_palette_0;
-  Register m_object_palette_1;
-  Register m_window_y;
-  Register m_window_x;
+
+  // Machine cycle the frame being drawn started at, and its next line.
+  uint64_t m_frame_start = 0;
+  uint8_t m_next_line = 0;
+
+#if defined(GAMERBOY_PARALLEL_PPU)
+  RenderWorker m_renderer;
+#else
+  FrameMailbox &m_frames;
+  LineRenderer m_renderer;
+#endif
 };
 
 } // namespace gb
@@ -23,86 +23,66 @@ private:
   uint8_t m_value = 0;
 };
 
-// 2-byte Register.
+// 2-byte Register, stored as a native word so 16-bit operations don't have
+// to split and rebuild it.
 class DoubleRegister {
 public:
-  DoubleRegister() = default;
-  ~DoubleRegister() = default;
+  constexpr DoubleRegister() = default;
 
-  uint16_t get_word() const {
-    return static_cast<uint16_t>((m_high << 8) | m_low);
+  constexpr uint16_t get_word() const { return m_word; }
+  constexpr uint8_t get_upper_register() const { return m_word >> 8; }
+  constexpr uint8_t get_lower_register() const { return m_word & 0xFF; }
+
+  constexpr void set_upper_register(uint8_t upper) {
+    m_word = static_cast<uint16_t>((m_word & 0x00FF) | (upper << 8));
   }
-  uint8_t get_upper_register() const { return m_high; }
-  uint8_t get_lower_register() const { return m_low; }
-
-  void set_upper_register(uint8_t upper) { m_high = upper; }
-  void set_lower_register(uint8_t lower) { m_low = lower; }
-  void set_word(uint16_t word) {
-    m_high = static_cast<uint8_t>((word & 0xFF00) >> 8);
-    m_low = static_cast<uint8_t>(word & 0x00FF);
+  constexpr void set_lower_register(uint8_t lower) {
+    m_word = static_cast<uint16_t>((m_word & 0xFF00) | lower);
   }
+  constexpr void set_word(uint16_t word) { m_word = word; }
 
   // Should only be used on the AF register
-  void set_flag(uint8_t flag, bool set) {
-    (set) ? m_low |= flag : m_low &= ~(flag);
-  }
-
-  void set_word(uint8_t upper, uint8_t lower) {
-    m_high = upper;
-    m_low = lower;
+  constexpr void set_flag(uint8_t flag, bool set) {
+    (set) ? m_word |= flag : m_word &= ~flag;
   }
 
-  DoubleRegister &operator=(uint16_t word) {
-    set_word(word);
-    return *this;
+  constexpr void set_word(uint8_t upper, uint8_t lower) {
+    m_word = static_cast<uint16_t>((upper << 8) | lower);
   }
 
-  DoubleRegister &operator++(int) {
-    uint16_t word = get_word();
-    set_word(++word);
+  constexpr DoubleRegister &operator=(uint16_t word) {
+    m_word = word;
     return *this;
   }
 
-  DoubleRegister &operator--(int) {
-    uint16_t word = get_word();
-    set_word(--word);
-    return *this;
-  }
+  // Like the built in ones, these return the value from before.
+  constexpr uint16_t operator++(int) { return m_word++; }
+  constexpr uint16_t operator--(int) { return m_word--; }
 
-  DoubleRegister &operator+=(uint16_t value) {
-    uint16_t word = get_word();
-    word += value;
-    set_word(word);
+  constexpr DoubleRegister &operator+=(uint16_t value) {
+    m_word += value;
     return *this;
   }
 
-  DoubleRegister &operator-=(uint16_t value) {
-    uint16_t word = get_word();
-    word -= value;
-    set_word(word);
+  constexpr DoubleRegister &operator-=(uint16_t value) {
+    m_word -= value;
     return *this;
   }
 
-  DoubleRegister &operator&=(uint16_t value) {
-    uint16_t word = get_word();
-    word &= value;
-    set_word(word);
+  constexpr DoubleRegister &operator&=(uint16_t value) {
+    m_word &= value;
     return *this;
   }
 
-  DoubleRegister &operator|=(uint16_t value) {
-    uint16_t word = get_word();
-    word |= value;
-    set_word(word);
+  constexpr DoubleRegister &operator|=(uint16_t value) {
+    m_word |= value;
     return *this;
   }
 
-  operator uint16_t() const { return get_word(); }
+  constexpr operator uint16_t() const { return m_word; }
 
 private:
-  // TODO: Use `Register` class?
-  uint8_t m_high = 0;
-  uint8_t m_low = 0;
+  uint16_t m_word = 0;
 };
 
 } // namespace gb
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "frame_mailbox.h"
+#include "line_renderer.h"
+
+#include <array>
+#include <cstdint>
+#include <semaphore>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace gb {
+
+// Takes the same calls as `LineRenderer`, but only logs them. The log of a
+// frame is replayed on a thread of its own while the CPU runs the next one,
+// the worker keeps its own copy of everything lines are drawn from and the
+// writes in the log keep it in step. A write lands between the same lines it
+// did on the CPU, so raster effects come out the same.
+class RenderWorker {
+public:
+  RenderWorker(FrameMailbox &frames);
+  ~RenderWorker();
+
+  void start_frame() { m_recording.push_back({Command::START_FRAME}); }
+  void draw_line(uint8_t line) {
+    m_recording.push_back({Command::DRAW_LINE, line});
+  }
+  void clear() { m_recording.push_back({Command::CLEAR}); }
+  void write(uint16_t address, uint8_t value) {
+    m_recording.push_back({Command::WRITE, value, address});
+  }
+
+  // Hands the frame over, it's published once it's drawn. Waits for the
+  // frame before to be done first, the worker is never more than one behind.
+  void finish_frame();
+
+private:
+  struct Command {
+    enum Type : uint8_t { START_FRAME, DRAW_LINE, CLEAR, WRITE };
+
+    Type type;
+    // The line for `DRAW_LINE`.
+    uint8_t value = 0;
+    uint16_t address = 0;
+  };
+
+  void run(std::stop_token stop);
+  void replay(const Command &command);
+
+  FrameMailbox &m_frames;
+
+  std::array<uint8_t, 0x2000> m_vram{};
+  std::array<uint8_t, 0xA0> m_oam{};
+  std::array<uint8_t, 0x100> m_io{};
+  LineRenderer m_renderer{{m_vram.data(), m_oam.data(), m_io.data()}};
+
+  // The CPU appends to `m_recording` while the worker replays `m_drawing`,
+  // they swap between frames.
+  std::vector<Command> m_recording;
+  std::vector<Command> m_drawing;
+  std::binary_semaphore m_submitted{0};
+  std::binary_semaphore m_idle{1};
+
+  // Last, it has to stop before the rest goes away.
+  std::jthread m_thread;
+};
+
+} // namespace gb
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+namespace gb {
+
+// Things that happen at a point in time. Events due on the same cycle are
+// handled in this order.
+enum class Event : uint8_t {
+  // The PPU starts VBlank and interrupts the CPU.
+  VBLANK,
+  // TIMA wraps around and interrupts the CPU.
+  TIMER_OVERFLOW,
+  // An OAM DMA transfer is over, the CPU can get at OAM again.
+  OAM_DMA_END,
+  // A full frame has been emulated with the LCD off, the frontend gets
+  // control back. With it on that happens at VBlank.
+  FRAME_END,
+};
+
+constexpr std::size_t EVENT_COUNT = 4;
+
+// Cycle of an event that isn't scheduled.
+constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+struct ScheduledEvent {
+  Event event;
+  // Machine cycles since power on.
+  uint64_t cycle;
+};
+
+// Pending events in a binary min-heap ordered by the machine cycle they're
+// due. Every event is in the heap at most once, rescheduling one moves it in
+// place.
+class Scheduler {
+public:
+  Scheduler();
+
+  // Schedules `event` at `cycle`, replacing when it was due before.
+  void schedule(Event event, uint64_t cycle);
+  void cancel(Event event);
+
+  bool is_scheduled(Event event) const {
+    return m_position[static_cast<std::size_t>(event)] != NOT_SCHEDULED;
+  }
+
+  // Cycle the earliest event is due, `NEVER` when nothing is scheduled.
+  uint64_t next_cycle() const {
+    return m_size != 0 ? m_heap[0].cycle : NEVER;
+  }
+
+  // Removes and returns the earliest event if it's due by `cycle`.
+  std::optional<ScheduledEvent> pop_due(uint64_t cycle);
+
+private:
+  static constexpr std::size_t NOT_SCHEDULED = EVENT_COUNT;
+
+  static bool before(const ScheduledEvent &a, const ScheduledEvent &b) {
+    return a.cycle != b.cycle ? a.cycle < b.cycle : a.event < b.event;
+  }
+
+  void place(std::size_t index, const ScheduledEvent &entry);
+  void sift_up(std::size_t index);
+  void sift_down(std::size_t index);
+  void remove(std::size_t index);
+
+  std::array<ScheduledEvent, EVENT_COUNT> m_heap{};
+  // Index of every event in `m_heap`, or `NOT_SCHEDULED`.
+  std::array<std::size_t, EVENT_COUNT> m_position{};
+  std::size_t m_size = 0;
+};
+
+} // namespace gb
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "frame_mailbox.h"
+#include "utility.h"
+
+#include <array>
+
+namespace gb {
+
+class Gameboy;
+
+// The SDL window frames are shown in. The emulator draws straight into its
+// textures through the mailbox, everything else here stays on the thread
+// that created it.
+class Screen {
+public:
+  Screen();
+  ~Screen();
+
+  FrameMailbox &get_frames() { return m_frames; }
+
+  // Runs `gameboy` on a thread of its own, this one polls events and shows
+  // the newest frame until the window closes.
+  void show(Gameboy &gameboy);
+
+private:
+  inline bool did_quit() { return m_did_close; }
+
+  // Handles window events, closing the window quits.
+  void process();
+  // Shows the newest frame, waiting for the display to refresh.
+  void present();
+
+  bool m_did_close = false;
+
+  utility::sdl_window_ptr m_window;
+  utility::sdl_renderer_ptr m_renderer;
+  // One for each frame in the mailbox. The two the emulator can draw into
+  // stay locked, the one being shown is unlocked.
+  std::array<utility::sdl_texture_ptr, 3> m_textures;
+
+  FrameMailbox m_frames;
+};
+
+} // namespace gb
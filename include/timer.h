@@ -0,0 +1,68 @@
+#pragma once
+
+#include "memory.h"
+#include "registers.h"
+
+#include <cstdint>
+
+namespace gb {
+
+class Gameboy;
+
+// DIV, TIMA, TMA and TAC. Nothing ticks, DIV follows from the machine cycle
+// counter and TIMA catches up to it when it's accessed. TIMA overflowing is
+// an event. TMA and TAC are kept in `Memory`, writes to them go through here
+// to bring TIMA up to date first.
+class Timer {
+public:
+  Timer(Gameboy &gb);
+
+  // Handles `Event::TIMER_OVERFLOW`, due at machine cycle `cycle` when TIMA
+  // wraps around, and schedules the next one.
+  void overflow(uint64_t cycle);
+
+  uint8_t read_divider();
+  // Any write resets DIV.
+  void write_divider(uint8_t value);
+  uint8_t read_counter();
+  void write_counter(uint8_t value);
+  void write_modulo(uint8_t value);
+  void write_control(uint8_t value);
+
+  // Machine cycle after `cycle` DIV, or TIMA, next counts up at.
+  uint64_t next_divider_change(uint64_t cycle);
+  uint64_t next_counter_change(uint64_t cycle);
+
+private:
+  bool is_enabled() { return m_mem.get_io(TIMER_CONTROL) & 0x04; }
+  // Clock cycles in between TIMA increments.
+  uint32_t counter_period() {
+    return COUNTER_PERIODS[m_mem.get_io(TIMER_CONTROL) & 0x03];
+  }
+  // Clock cycles the internal divider has counted by machine cycle `cycle`,
+  // DIV is bits 8-15 of it.
+  uint64_t divider_clocks(uint64_t cycle) {
+    return (cycle - m_divider_reset) * 4;
+  }
+
+  // Adds the TIMA increments up to machine cycle `cycle`, with a reload from
+  // TMA on every overflow.
+  void sync(uint64_t cycle);
+  // After TIMA, TAC or DIV changed.
+  void schedule_overflow();
+
+  // TIMA counts on a falling edge of bit 9, 3, 5 or 7 of the divider.
+  static constexpr uint32_t COUNTER_PERIODS[4] = {1024, 16, 64, 256};
+
+  Gameboy &m_gb;
+  Memory &m_mem;
+
+  // Machine cycle DIV was last reset at.
+  uint64_t m_divider_reset = 0;
+  // Machine cycle TIMA is up to date at.
+  uint64_t m_synced_cycle = 0;
+
+  Register m_counter;
+};
+
+} // namespace gb
@@ -3,33 +3,19 @@
 #include <SDL2/SDL.h>
 #include <cstddef>
 #include <filesystem>
-#include <fstream>
+#include <fcntl.h>
 #include <iostream>
 #include <memory>
-#include <vector>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
 namespace gb {
 namespace utility {
 
-struct Mask {
-  std::uint16_t value;
-  std::uint16_t mask;
-
-  friend bool operator<(Mask const &a, Mask const &b) {
-    return a.value < (a.mask & b.value);
-  }
-
-  friend bool operator<(Mask const &a, std::uint16_t b) {
-    return a.value < (a.mask & b);
-  }
-
-  friend bool operator<(std::uint16_t a, Mask const &b) {
-    return b.value < (b.mask & a);
-  }
-};
-
 using sdl_texture_ptr =
     std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)>;
 using sdl_renderer_ptr =
@@ -42,36 +28,42 @@ static void error(const char *msg, uint8_t status) {
   std::exit(status);
 }
 
-static std::vector<std::byte> get_data(const fs::path &&p) {
-
-  if (!fs::exists(p))
-    utility::error("Does this path to rom really exist?", 1);
-
-  std::ifstream ifs(p, std::ios::binary | std::ios::ate);
-  auto end = ifs.tellg();
-
-  ifs.seekg(0, std::ios::beg);
-
-  auto size = std::size_t(end - ifs.tellg());
-
-  if (!size)
-    return {};
-
-  std::vector<std::byte> buffer(size);
+// A whole file mapped read-only. The pages come straight from the page
+// cache, so every emulator mapping the same ROM shares one copy of it.
+class MappedFile {
+public:
+  MappedFile(const fs::path &p) {
+    if (!fs::exists(p))
+      utility::error("Does this path to rom really exist?", 1);
+
+    int fd = open(p.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+      error("Cannot open ROM!", 1);
+
+    std::size_t size = info.st_size;
+    if (size != 0) {
+      void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+        error("Cannot map ROM!", 1);
+      m_data = {static_cast<const std::byte *>(data), size};
+    }
+    close(fd);
+  }
 
-  if (!ifs.read((char *)buffer.data(), buffer.size()))
-    error("Cannot insert ROM data!", 1);
+  ~MappedFile() {
+    if (!m_data.empty())
+      munmap(const_cast<std::byte *>(m_data.data()), m_data.size());
+  }
 
-  return buffer;
-}
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
 
-static std::vector<std::byte> get_boot_rom_data() {
-  return get_data(fs::path("../boot_rom/dmg_boot.bin"));
-}
+  std::span<const std::byte> data() const { return m_data; }
 
-static std::vector<std::byte> get_rom_data(const fs::path &p) {
-  return get_data(std::move(p));
-}
+private:
+  std::span<const std::byte> m_data;
+};
 
 } // namespace utility
 } // namespace gb
@@ -1,11 +1,213 @@
 #include "cartridge.h"
 
+#include "utility.h"
+
+#include <algorithm>
+
 namespace gb {
 
-uint8_t NoMbc::read(uint16_t addr) {
-  return static_cast<uint8_t>(m_rom_data.at(addr));
+// Logo at 0x0104-0x0133 of every licensed cartridge. The DMG boot ROM
+// compares it against its own copy, and locks up if it's different.
+constexpr std::array<uint8_t, 0x30> NINTENDO_LOGO{
+    0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B, 0x03, 0x73, 0x00, 0x83,
+    0x00, 0x0C, 0x00, 0x0D, 0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
+    0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99, 0xBB, 0xBB, 0x67, 0x63,
+    0x6E, 0x0E, 0xEC, 0xCC, 0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E};
+
+CartridgeInformation::CartridgeInformation(std::span<const std::byte> rom) {
+  if (rom.size() < 0x150)
+    utility::error("ROM is too small to have a header", 1);
+
+  auto rom_cast = [&](uint16_t address) -> uint16_t {
+    return static_cast<uint16_t>(rom[address]);
+  };
+
+  switch (rom_cast(0x147)) {
+  // ROM ONLY, ROM+RAM, ROM+RAM+BATTERY
+  case 0x00:
+  case 0x08:
+  case 0x09:
+    m_type = CartridgeType::GB_NO_MBC;
+    break;
+  case 0x01:
+  case 0x02:
+  case 0x03:
+    m_type = CartridgeType::GB_MBC1;
+    break;
+  case 0x0F:
+  case 0x10:
+  case 0x11:
+  case 0x12:
+  case 0x13:
+    m_type = CartridgeType::GB_MBC3;
+    break;
+  case 0x19:
+  case 0x1A:
+  case 0x1B:
+  case 0x1C:
+  case 0x1D:
+  case 0x1E:
+    m_type = CartridgeType::GB_MBC5;
+    break;
+  default:
+    utility::error("Unsupported cartridge type", 1);
+  }
+
+  if (rom_cast(0x149) >= ram_sizes.size())
+    utility::error("Unsupported cartridge RAM size", 1);
+  m_ram_size = ram_sizes[rom_cast(0x149)];
+  m_version = rom_cast(0x14C);
+
+  bool logo_valid = std::equal(
+      NINTENDO_LOGO.begin(), NINTENDO_LOGO.end(), rom.begin() + 0x104,
+      [](uint8_t a, std::byte b) { return a == static_cast<uint8_t>(b); });
+  // The checksum covers the title through the version.
+  uint8_t checksum = 0;
+  for (uint16_t address = 0x134; address < 0x14D; address++)
+    checksum = checksum - rom_cast(address) - 1;
+  m_header_valid = logo_valid && checksum == rom_cast(0x14D);
+}
+
+void Mbc1::write(uint16_t addr, uint8_t value) {
+  switch (addr >> 13) {
+  case 0:
+    m_ram_enabled = (value & 0x0F) == 0x0A;
+    break;
+  case 1:
+    // Bank 0 can't be selected here, it reads as bank 1.
+    m_lower_bank = std::max(value & 0x1F, 1);
+    break;
+  case 2:
+    m_upper_bank = value & 0x03;
+    break;
+  case 3:
+    m_mode = value & 0x01;
+    break;
+  }
+}
+
+void Mbc3::write(uint16_t addr, uint8_t value) {
+  switch (addr >> 13) {
+  case 0:
+    m_ram_enabled = (value & 0x0F) == 0x0A;
+    break;
+  case 1:
+    m_rom_bank = std::max(value & 0x7F, 1);
+    break;
+  case 2:
+    m_ram_bank = value;
+    break;
+  // Latching the clock does nothing, it doesn't run.
+  case 3:
+    break;
+  }
+}
+
+uint8_t Mbc3::read_clock() const {
+  return m_ram_bank <= 0x0C ? m_clock[m_ram_bank - 0x08] : 0xFF;
+}
+
+void Mbc3::write_clock(uint8_t value) {
+  if (m_ram_bank <= 0x0C)
+    m_clock[m_ram_bank - 0x08] = value;
+}
+
+void Mbc5::write(uint16_t addr, uint8_t value) {
+  switch (addr >> 12) {
+  case 0:
+  case 1:
+    m_ram_enabled = (value & 0x0F) == 0x0A;
+    break;
+  case 2:
+    m_rom_bank = (m_rom_bank & 0x100) | value;
+    break;
+  case 3:
+    m_rom_bank = (m_rom_bank & 0xFF) | (value & 0x01) << 8;
+    break;
+  case 4:
+  case 5:
+    m_ram_bank = value & 0x0F;
+    break;
+  }
+}
+
+Cartridge::Cartridge(std::span<const std::byte> data)
+    : m_rom_data(data), m_cartridge_info(m_rom_data),
+      m_mbc(make_mbc(m_cartridge_info.get_type())),
+      m_rom_banks(std::max<std::size_t>(m_rom_data.size() / 0x4000, 1)) {
+  m_ram_data.resize(m_cartridge_info.get_ram_size());
 }
 
-void NoMbc::write(uint16_t addr, uint8_t value) { return; }
+Cartridge::mbc_t
+Cartridge::make_mbc(CartridgeInformation::CartridgeType type) {
+  switch (type) {
+  case CartridgeInformation::CartridgeType::GB_MBC1:
+    return Mbc1{};
+  case CartridgeInformation::CartridgeType::GB_MBC3:
+    return Mbc3{};
+  case CartridgeInformation::CartridgeType::GB_MBC5:
+    return Mbc5{};
+  default:
+    return NoMbc{};
+  }
+}
+
+void Cartridge::write(uint16_t addr, uint8_t value) {
+  std::visit([&](auto &mbc) { mbc.write(addr, value); }, m_mbc);
+}
+
+uint16_t Cartridge::get_rom_bank0() const {
+  return std::visit([](const auto &mbc) { return mbc.get_rom_bank0(); },
+                    m_mbc) %
+         m_rom_banks;
+}
+
+uint16_t Cartridge::get_rom_bank() const {
+  return std::visit([](const auto &mbc) { return mbc.get_rom_bank(); },
+                    m_mbc) %
+         m_rom_banks;
+}
+
+uint8_t *Cartridge::get_ram_bank_data() {
+  if (m_ram_data.empty())
+    return nullptr;
+
+  bool enabled = std::visit(
+      [](const auto &mbc) { return mbc.is_ram_enabled(); }, m_mbc);
+  if (!enabled)
+    return nullptr;
+  if (auto *mbc3 = std::get_if<Mbc3>(&m_mbc);
+      mbc3 && mbc3->is_clock_selected())
+    return nullptr;
+
+  uint8_t bank =
+      std::visit([](const auto &mbc) { return mbc.get_ram_bank(); }, m_mbc);
+  std::size_t banks = std::max<std::size_t>(m_ram_data.size() / 0x2000, 1);
+  return m_ram_data.data() + (bank % banks) * 0x2000;
+}
+
+std::size_t Cartridge::get_ram_bank_size() const {
+  return std::min<std::size_t>(m_ram_data.size(), 0x2000);
+}
+
+uint8_t Cartridge::read_ram(uint16_t addr) {
+  if (auto *mbc3 = std::get_if<Mbc3>(&m_mbc);
+      mbc3 && mbc3->is_ram_enabled() && mbc3->is_clock_selected())
+    return mbc3->read_clock();
+  return 0xFF;
+}
+
+void Cartridge::write_ram(uint16_t addr, uint8_t value) {
+  if (auto *mbc3 = std::get_if<Mbc3>(&m_mbc);
+      mbc3 && mbc3->is_ram_enabled() && mbc3->is_clock_selected())
+    mbc3->write_clock(value);
+}
+
+uint8_t Cartridge::read(uint16_t addr) const {
+  std::size_t bank = addr < 0x4000 ? get_rom_bank0() : get_rom_bank();
+  std::size_t offset = bank * 0x4000 + (addr & 0x3FFF);
+  return offset < m_rom_data.size() ? static_cast<uint8_t>(m_rom_data[offset])
+                                    : 0xFF;
+}
 
 } // namespace gb
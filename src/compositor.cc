@@ -0,0 +1,149 @@
+#include "compositor.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace gb {
+
+// Background colors are 0-3, sprite colors 4-7 with OBP0 and 8-11 with OBP1.
+static std::array<uint8_t, 16> get_shade_table(const Palettes &palettes) {
+  std::array<uint8_t, 16> table{};
+  for (uint8_t color = 0; color < 4; color++) {
+    table[color] = palettes.background >> color * 2 & 0x03;
+    table[4 + color] = palettes.object_0 >> color * 2 & 0x03;
+    table[8 + color] = palettes.object_1 >> color * 2 & 0x03;
+  }
+  return table;
+}
+
+void composite_scalar(const LineLayers &layers, std::size_t count,
+                      const Palettes &palettes, uint32_t *pixels) {
+  std::array<uint8_t, 16> shades = get_shade_table(palettes);
+  for (std::size_t x = 0; x < count; x++) {
+    uint8_t background = layers.background[x];
+    uint8_t sprite = layers.sprites[x];
+    uint8_t flags = layers.sprite_flags[x];
+
+    uint8_t index = background;
+    if (sprite != 0 && (!(flags & SPRITE_BEHIND) || background == 0))
+      index = 4 + (flags & SPRITE_PALETTE_1) * 4 + sprite;
+    pixels[x] = SHADES[shades[index]];
+  }
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is always there on x86-64, but has no byte shuffle: table lookups
+// compare against every entry instead.
+void composite_sse2(const LineLayers &layers, std::size_t count,
+                    const Palettes &palettes, uint32_t *pixels) {
+  std::array<uint8_t, 16> table = get_shade_table(palettes);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i behind = _mm_set1_epi8(SPRITE_BEHIND);
+  const __m128i palette_1 = _mm_set1_epi8(SPRITE_PALETTE_1);
+
+  for (std::size_t x = 0; x < count; x += 16) {
+    __m128i background = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(layers.background + x));
+    __m128i sprite =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(layers.sprites + x));
+    __m128i flags = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(layers.sprite_flags + x));
+
+    // Opaque, and in front or over background color 0.
+    __m128i in_front = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_and_si128(flags, behind), zero),
+        _mm_cmpeq_epi8(background, zero));
+    __m128i shown = _mm_andnot_si128(_mm_cmpeq_epi8(sprite, zero), in_front);
+    // 4 + palette * 4 + color, the palette bit is 1.
+    __m128i sprite_index = _mm_add_epi8(
+        _mm_add_epi8(sprite, _mm_set1_epi8(4)),
+        _mm_slli_epi16(_mm_and_si128(flags, palette_1), 2));
+    __m128i index = _mm_or_si128(_mm_and_si128(shown, sprite_index),
+                                 _mm_andnot_si128(shown, background));
+
+    __m128i shade = zero;
+    for (uint8_t i = 0; i < 12; i++)
+      shade = _mm_or_si128(
+          shade, _mm_and_si128(_mm_cmpeq_epi8(index, _mm_set1_epi8(i)),
+                               _mm_set1_epi8(table[i])));
+
+    // Four pixels at a time widened to 32 bits.
+    __m128i words[2] = {_mm_unpacklo_epi8(shade, zero),
+                        _mm_unpackhi_epi8(shade, zero)};
+    for (std::size_t half = 0; half < 2; half++) {
+      __m128i quads[2] = {_mm_unpacklo_epi16(words[half], zero),
+                          _mm_unpackhi_epi16(words[half], zero)};
+      for (std::size_t quad = 0; quad < 2; quad++) {
+        __m128i argb = zero;
+        for (uint8_t i = 0; i < 4; i++) {
+          __m128i match = _mm_cmpeq_epi32(quads[quad], _mm_set1_epi32(i));
+          argb = _mm_or_si128(argb,
+                              _mm_and_si128(match, _mm_set1_epi32(SHADES[i])));
+        }
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(pixels + x + half * 8 + quad * 4),
+            argb);
+      }
+    }
+  }
+}
+
+// The palette lookup is a byte shuffle and the shades a permute.
+__attribute__((target("avx2"))) void
+composite_avx2(const LineLayers &layers, std::size_t count,
+               const Palettes &palettes, uint32_t *pixels) {
+  std::array<uint8_t, 16> table = get_shade_table(palettes);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i behind = _mm256_set1_epi8(SPRITE_BEHIND);
+  const __m256i palette_1 = _mm256_set1_epi8(SPRITE_PALETTE_1);
+  const __m256i shade_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data())));
+  const __m256i shades = _mm256_setr_epi32(SHADES[0], SHADES[1], SHADES[2],
+                                           SHADES[3], 0, 0, 0, 0);
+
+  for (std::size_t x = 0; x < count; x += 32) {
+    __m256i background = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(layers.background + x));
+    __m256i sprite = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(layers.sprites + x));
+    __m256i flags = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(layers.sprite_flags + x));
+
+    __m256i in_front = _mm256_or_si256(
+        _mm256_cmpeq_epi8(_mm256_and_si256(flags, behind), zero),
+        _mm256_cmpeq_epi8(background, zero));
+    __m256i shown =
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(sprite, zero), in_front);
+    __m256i sprite_index = _mm256_add_epi8(
+        _mm256_add_epi8(sprite, _mm256_set1_epi8(4)),
+        _mm256_slli_epi16(_mm256_and_si256(flags, palette_1), 2));
+    __m256i index = _mm256_blendv_epi8(background, sprite_index, shown);
+    __m256i shade = _mm256_shuffle_epi8(shade_table, index);
+
+    // Eight pixels at a time widened to 32 bits.
+    __m128i halves[2] = {_mm256_castsi256_si128(shade),
+                         _mm256_extracti128_si256(shade, 1)};
+    for (std::size_t i = 0; i < 4; i++) {
+      __m128i bytes = i % 2 ? _mm_srli_si128(halves[i / 2], 8) : halves[i / 2];
+      __m256i lanes = _mm256_cvtepu8_epi32(bytes);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + x + i * 8),
+                          _mm256_permutevar8x32_epi32(shades, lanes));
+    }
+  }
+}
+
+#endif
+
+compositor_t get_compositor() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    return composite_avx2;
+  return composite_sse2;
+#else
+  return composite_scalar;
+#endif
+}
+
+} // namespace gb
@@ -1,623 +1,997 @@
 #include "cpu.h"
 
 #include "gameboy.h"
+#include "opcodes.h"
+
+#if defined(GAMERBOY_AOT)
+#include "aot.h"
+
+#include <iostream>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <utility>
 
 namespace gb {
 
 // clang-format off
-const std::array<uint8_t, 256> OPCODE_CYCLES = {
-    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
-    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
-    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
-    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4,
-    2, 3, 3, 0, 3, 4, 2, 4, 2, 4, 3, 0, 3, 0, 2, 4,
-    3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4,
-    3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4
-};
+constinit const std::array<CPU::opcode_method_t, 256> CPU::opcode_table = [] {
+  std::array<opcode_method_t, 256> table{};
+  table.fill(&CPU::op_illegal);
+
+  // Opcode families that share a handler template, one instance per opcode.
+  [&]<std::size_t... i>(std::index_sequence<i...>) {
+    ((table[0x01 + 0x10 * i] = &CPU::op_ld_rr_d16<0x01 + 0x10 * i>), ...);
+    ((table[0x03 + 0x10 * i] = &CPU::op_inc_rr<0x03 + 0x10 * i>), ...);
+    ((table[0x09 + 0x10 * i] = &CPU::op_add_hl_rr<0x09 + 0x10 * i>), ...);
+    ((table[0x0B + 0x10 * i] = &CPU::op_dec_rr<0x0B + 0x10 * i>), ...);
+    ((table[0xC1 + 0x10 * i] = &CPU::op_pop_rr<0xC1 + 0x10 * i>), ...);
+    ((table[0xC5 + 0x10 * i] = &CPU::op_push_rr<0xC5 + 0x10 * i>), ...);
+
+    ((table[0x20 + 0x08 * i] = &CPU::op_jr_cc_r8<0x20 + 0x08 * i>), ...);
+    ((table[0xC0 + 0x08 * i] = &CPU::op_ret_cc<0xC0 + 0x08 * i>), ...);
+    ((table[0xC2 + 0x08 * i] = &CPU::op_jp_cc_a16<0xC2 + 0x08 * i>), ...);
+    ((table[0xC4 + 0x08 * i] = &CPU::op_call_cc_a16<0xC4 + 0x08 * i>), ...);
+  }(std::make_index_sequence<4>{});
+
+  [&]<std::size_t... i>(std::index_sequence<i...>) {
+    ((table[0x04 + 0x08 * i] = &CPU::op_inc_r<0x04 + 0x08 * i>), ...);
+    ((table[0x05 + 0x08 * i] = &CPU::op_dec_r<0x05 + 0x08 * i>), ...);
+    ((table[0x06 + 0x08 * i] = &CPU::op_ld_r_d8<0x06 + 0x08 * i>), ...);
+    ((table[0xC6 + 0x08 * i] = &CPU::op_alu_a_d8<0xC6 + 0x08 * i>), ...);
+    ((table[0xC7 + 0x08 * i] = &CPU::op_rst<0xC7 + 0x08 * i>), ...);
+  }(std::make_index_sequence<8>{});
+
+  // 0x40 - 0x7F: ld r,r
+  // 0x80 - 0xBF: add, adc, sub, sbc, and, xor, or, cp
+  [&]<std::size_t... i>(std::index_sequence<i...>) {
+    ((table[0x40 + i] = &CPU::op_ld_r_r<0x40 + i>), ...);
+    ((table[0x80 + i] = &CPU::op_alu_a_r<0x80 + i>), ...);
+  }(std::make_index_sequence<64>{});
+
+  table[0x00] = &CPU::op_nop;
+  table[0x02] = &CPU::op_ld_drr_a<0x02>;
+  table[0x07] = &CPU::op_rlca;
+  table[0x08] = &CPU::op_ld_da16_sp;
+  table[0x0A] = &CPU::op_ld_a_drr<0x0A>;
+  table[0x0F] = &CPU::op_rrca;
+
+  table[0x10] = &CPU::op_stop;
+  table[0x12] = &CPU::op_ld_drr_a<0x12>;
+  table[0x17] = &CPU::op_rla;
+  table[0x18] = &CPU::op_jr_r8;
+  table[0x1A] = &CPU::op_ld_a_drr<0x1A>;
+  table[0x1F] = &CPU::op_rra;
+
+  table[0x22] = &CPU::op_ld_dhli_a;
+  table[0x27] = &CPU::op_daa;
+  table[0x2A] = &CPU::op_ld_a_dhli;
+  table[0x2F] = &CPU::op_cpl;
+
+  table[0x32] = &CPU::op_ld_dhld_a;
+  table[0x37] = &CPU::op_scf;
+  table[0x3A] = &CPU::op_ld_a_dhld;
+  table[0x3F] = &CPU::op_ccf;
+
+  table[0x76] = &CPU::op_halt;
+
+  table[0xC3] = &CPU::op_jp_a16;
+  table[0xC9] = &CPU::op_ret;
+  table[0xCB] = &CPU::op_prefix_cb;
+  table[0xCD] = &CPU::op_call_a16;
+
+  table[0xD9] = &CPU::op_reti;
+
+  table[0xE0] = &CPU::op_ld_da8_a;
+  table[0xE2] = &CPU::op_ld_dc_a;
+  table[0xE8] = &CPU::op_add_sp_r8;
+  table[0xE9] = &CPU::op_jp_hl;
+  table[0xEA] = &CPU::op_ld_da16_a;
+
+  table[0xF0] = &CPU::op_ld_a_da8;
+  table[0xF2] = &CPU::op_ld_a_dc;
+  table[0xF3] = &CPU::op_di;
+  table[0xF8] = &CPU::op_ld_hl_sp_r8;
+  table[0xF9] = &CPU::op_ld_sp_hl;
+  table[0xFA] = &CPU::op_ld_a_da16;
+  table[0xFB] = &CPU::op_ei;
+
+  return table;
+}();
+
+constinit const std::array<CPU::opcode_method_t, 256> CPU::cb_opcode_table = [] {
+  std::array<opcode_method_t, 256> table{};
+
+  // 0x00 - 0x3F: rlc, rrc, rl, rr, sla, sra, swap, srl
+  // 0x40 - 0x7F: bit n,r
+  // 0x80 - 0xBF: res n,r
+  // 0xC0 - 0xFF: set n,r
+  [&]<std::size_t... i>(std::index_sequence<i...>) {
+    ((table[0x00 + i] = &CPU::op_rotate_r<0x00 + i>), ...);
+    ((table[0x40 + i] = &CPU::op_bit_n_r<0x40 + i>), ...);
+    ((table[0x80 + i] = &CPU::op_res_n_r<0x80 + i>), ...);
+    ((table[0xC0 + i] = &CPU::op_set_n_r<0xC0 + i>), ...);
+  }(std::make_index_sequence<64>{});
+
+  return table;
+}();
 // clang-format on
 
 CPU::CPU(Gameboy &gb)
     : m_gb(gb), m_cartridge(m_gb.get_cartridge()), m_memory(m_gb.get_memory()) {
-  m_pc = 0x0;
-}
+  m_registers.pc = 0x0;
 
-uint8_t CPU::cycle() {
-  uint8_t opcode = read_memory(m_pc++);
-  if (opcode_map.count(opcode)) {
-    auto method_ptr = opcode_map.find(opcode)->second;
-    (this->*method_ptr)(opcode);
-    return OPCODE_CYCLES[opcode];
-  }
-  return 0;
-}
+#if defined(GAMERBOY_AOT)
+  m_aot_enabled = true;
+  for (uint16_t i = 0; i < Aot::rom_header.size(); i++)
+    if (m_cartridge.read(0x134 + i) != Aot::rom_header[i])
+      m_aot_enabled = false;
 
-uint8_t CPU::read_memory(uint16_t address) {
-  uint8_t ret = m_memory.read_memory(address);
-  return ret;
+  if (!m_aot_enabled)
+    std::cerr << "Translated code is for a different ROM, interpreting\n";
+#endif
 }
 
-void CPU::write_memory(uint16_t address, uint8_t value) {
-  m_memory.write_memory(address, value);
-}
-
-bool CPU::condition_code(uint8_t opcode) {
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
-  switch (get_conditional_code(opcode)) {
-  case 0:
-    return !(f & Flags::ZERO_FLAG);
-  case 1:
-    return (f & Flags::ZERO_FLAG);
-  case 2:
-    return !(f & Flags::CARRY_FLAG);
-  case 3:
-    return (f & Flags::CARRY_FLAG);
-  }
-
-  return false;
+uint8_t CPU::cycle() {
+  uint8_t opcode = read_memory(m_registers.pc++);
+  fetch_immediate(opcode);
+  (this->*opcode_table[opcode])(opcode);
+  return OPCODE_CYCLES[opcode] + take_extra_cycles();
 }
 
-// Opcode: 0x00
-// Flags: ----
-// No operation
-void CPU::op_nop(uint8_t opcode) {}
-
-// Opcode: x1
-// rr=nn (rr may be BC,DE,HL or SP)
-void CPU::op_ld_rr_d16(uint8_t opcode) {
-  auto compose_word = [&, this]() -> uint16_t {
-    uint16_t value = read_memory(m_pc++);
-    value |= read_memory(m_pc++) << 8;
-    return value;
-  };
-
-  uint8_t register_id = get_register(opcode);
-  uint16_t value = compose_word();
-  m_registers[register_id] = value;
-}
+uint64_t CPU::run_until(uint64_t cycle_deadline) {
+  if (m_cycles >= cycle_deadline)
+    return m_cycles;
 
-// Opcode: x02, 0x12
-// Flags: ----
-// (BC)=A && (DE)=A
-void CPU::op_ld_drr_a(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  uint16_t reg = m_registers[register_id];
-  write_memory(reg, opcode);
-}
+  // Both of these can take the CPU past the deadline, the batch would wrap.
+  if (m_registers.interrupt_enable_pending) {
+    enable_interrupts_delayed();
+    if (m_cycles >= cycle_deadline)
+      return m_cycles;
+  }
 
-// Opcode: 0x0A, 0x1A
-// Flags: ----
-// A=(BC), A=(DE)
-void CPU::op_ld_a_drr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[Registers::AF] &= 0xFF;
-  m_registers[Registers::AF] |= read_memory(m_registers[register_id]) << 8;
-}
+  handle_interrupts();
+  if (m_cycles >= cycle_deadline)
+    return m_cycles;
 
-// Opcode: 0x22
-// Flags: ----
-// (HL)=A, HL=HL+1
-void CPU::op_ld_dhli_a(uint8_t opcode) {
-  write_memory(m_registers[Registers::HL]++,
-               m_registers[Registers::AF].get_upper_register());
-}
+  // Only an event can raise the interrupt that ends HALT, skip straight to
+  // the next one.
+  if (m_registers.halted) {
+    m_cycles = std::max(m_cycles, cycle_deadline);
+    return m_cycles;
+  }
 
-// Opcode: 0x2A
-// Flags: ----
-// A=[HL], HL=HL+1
-void CPU::op_ld_a_dhli(uint8_t opcode) {
-  m_registers[Registers::AF].set_upper_register(
-      read_memory(m_registers[Registers::HL]++));
+  m_batch_cycles = cycle_deadline - m_cycles;
+  m_cycles += run();
+  m_batch_cycles = 0;
+  m_batch_elapsed = 0;
+  return m_cycles;
 }
 
-// Opcode: 0x32
-// Flags: ----
-// (HL)=A, HL=HL-1
-void CPU::op_ld_dhld_a(uint8_t opcode) {
-  write_memory(m_registers[Registers::HL]--,
-               m_registers[Registers::AF].get_upper_register());
-}
+void CPU::shorten_batch(uint64_t cycle_deadline) {
+  // Mid batch `m_cycles` is still where the batch started.
+  if (m_batch_cycles == 0 || cycle_deadline >= m_cycles + m_batch_cycles)
+    return;
 
-// Opcode: 0x3A
-// Flags: ----
-// A=[HL], HL=HL-1
-void CPU::op_ld_a_dhld(uint8_t opcode) {
-  m_registers[Registers::AF].set_upper_register(
-      read_memory(m_registers[Registers::HL]--));
+  m_batch_cycles = cycle_deadline > m_cycles ? cycle_deadline - m_cycles : 0;
+#if defined(GAMERBOY_BLOCK_CACHE) || defined(GAMERBOY_AOT)
+  m_exit_block = true;
+#endif
 }
 
-// Opcode: 0x36
-// Flags: ----
-// (HL)=n
-void CPU::op_ld_dhl_d8(uint8_t opcode) {
-  uint8_t address = read_memory(m_pc++);
-  write_memory(m_registers[Registers::HL], address);
-}
+void CPU::handle_interrupts() {
+  uint8_t pending = m_registers.interrupt_flag & m_registers.interrupt_mask;
+  if (pending == 0)
+    return;
 
-// Opcode: 0x08
-// Flags: ----
-// (nn)=SP
-void CPU::op_ld_da16_sp(uint8_t opcode) {
-  uint16_t address = read_memory(m_pc++);
-  address |= read_memory(m_pc++) << 8;
-  write_memory(address, m_registers[Registers::SP] & 0xFF);
-  write_memory(address, m_registers[Registers::SP] >> 8);
-}
+  m_registers.halted = false;
+  if (!m_registers.interrupt_enable)
+    return;
 
-// Opcode: x6
-// r=n
-void CPU::op_ld_hr_d8(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id] &= 0xFF;
-  m_registers[register_id] |= read_memory(m_pc++) << 8;
+  uint8_t bit = std::countr_zero(pending);
+  m_registers.interrupt_flag &= ~(1 << bit);
+  m_registers.interrupt_enable = 0;
+  push(m_registers.pc);
+  m_registers.pc = INTERRUPT_VECTORS + bit * 8;
+  m_cycles += INTERRUPT_CYCLES;
 }
 
-// Opcode: xE
-// r=n
-void CPU::op_ld_lr_d8(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id] &= 0xFF;
-  m_registers[register_id] |= read_memory(m_pc++);
-}
+void CPU::enable_interrupts_delayed() {
+  m_cycles += cycle();
 
-// Opcode: x3
-// rr = rr+1 ; rr may be BC,DE,HL,SP
-void CPU::op_inc_rr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id]++;
+  // DI right after EI cancels it, and `ei; halt` has already enabled IME in
+  // `op_halt`.
+  if (m_registers.interrupt_enable_pending) {
+    m_registers.interrupt_enable = 1;
+    m_registers.interrupt_enable_pending = false;
+  }
 }
 
-// Opcode: xB
-// rr = rr-1 ; rr may be BC,DE,HL,SP
-void CPU::op_dec_rr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id]--;
+void CPU::request_interrupt(uint8_t interrupt) {
+  m_registers.interrupt_flag |= interrupt;
 }
 
-// Opcode: 0x34
-// Flags: z0h-
-// (HL)=(HL)+1
-void CPU::op_inc_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]) + 1;
-  write_memory(m_registers[Registers::HL], value);
-
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (value & 0x0F) == 0);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, (value & 0xFF) == 0);
+void CPU::write_interrupt_flag(uint8_t value) {
+  m_registers.interrupt_flag = value;
+  shorten_batch(0);
 }
 
-// Opcode: 0x35
-// Flags: z1h-
-// (HL)=(HL)-1
-void CPU::op_dec_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]) - 1;
-  write_memory(m_registers[Registers::HL], value);
-
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (value & 0x0F) == 0);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, (value & 0xFF) == 0);
+void CPU::write_interrupt_enable(uint8_t value) {
+  m_registers.interrupt_mask = value;
+  shorten_batch(0);
 }
 
-// Opcode: x4
-// Flags: z0h-
-// r=r+1
-void CPU::op_inc_hr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id] += 0x100;
-
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-
-  bool has_half_carry = ((m_registers[register_id] & 0x0F00) == 0);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, has_half_carry);
-
-  bool has_zero = ((m_registers[register_id] & 0xFF00) == 0);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, has_zero);
+void CPU::skip_boot(uint64_t cycle) {
+  // The boot ROM's last step leaves H and C set unless the header checksum
+  // is 0x00, Z is always set.
+  uint8_t flags = m_gb.get_cartridge().read(0x014D) != 0x00 ? 0xB0 : 0x80;
+  m_registers[Registers::AF] = 0x0100 | flags;
+  m_registers[Registers::BC] = 0x0013;
+  m_registers[Registers::DE] = 0x00D8;
+  m_registers[Registers::HL] = 0x014D;
+  m_registers[Registers::SP] = 0xFFFE;
+  m_registers.pc = 0x0100;
+  m_cycles = cycle;
 }
 
-// Opcode: x5
-// Flags: z1h-
-// r=r-1
-void CPU::op_dec_hr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  m_registers[register_id] -= 0x100;
+#if defined(GAMERBOY_AOT)
 
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
+// Translated blocks run until one ends or a write switches banks, anything
+// `gamerboy-aot` didn't reach runs on the interpreter.
+uint64_t CPU::run() {
+  uint64_t elapsed = 0;
+  while (elapsed < m_batch_cycles) {
+    const AotBlock *block = nullptr;
+    if (m_aot_enabled && m_registers.pc < 0x8000)
+      block = Aot::find((m_memory.get_rom_bank(m_registers.pc) << 16) |
+                        m_registers.pc);
 
-  bool has_half_carry = ((m_registers[register_id] & 0x0F00) == 0);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, has_half_carry);
+    m_batch_elapsed = elapsed;
+    if (block == nullptr) {
+      elapsed += cycle();
+      continue;
+    }
 
-  bool has_zero = ((m_registers[register_id] & 0xFF00) == 0);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, has_zero);
-}
-
-void CPU::op_inc_lr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  uint8_t value = m_registers[register_id].get_lower_register() + 1;
-  m_registers[register_id].set_lower_register(value);
-
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-
-  if ((m_registers[register_id] & 0x0F) == 0) {
-    m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, true);
+    elapsed += block->run(*this);
+    m_exit_block = false;
   }
-
-  if ((m_registers[register_id] & 0xFF) == 0) {
-    m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, true);
+  return elapsed;
+}
+
+#elif defined(GAMERBOY_BLOCK_CACHE)
+
+// Longest run of instructions decoded into a single block.
+constexpr std::size_t MAX_BLOCK_INSTRUCTIONS = 64;
+
+#if defined(GAMERBOY_JIT)
+// Runs of a ROM block before it gets recompiled.
+constexpr uint32_t JIT_THRESHOLD = 16;
+#endif
+
+// Only code running from ROM, WRAM and HRAM gets cached.
+constexpr bool is_cached_ram(uint16_t address) {
+  return (address >= 0xC000 && address < 0xE000) ||
+         (address >= 0xFF80 && address < 0xFFFF);
+}
+
+uint64_t CPU::run() {
+  uint64_t elapsed = 0;
+  while (elapsed < m_batch_cycles) {
+    uint16_t address = m_registers.pc;
+    Block *block = get_block(address);
+    m_batch_elapsed = elapsed;
+#if defined(GAMERBOY_IDLE_SKIP)
+    uint64_t block_start = elapsed;
+#endif
+    if (block == nullptr) {
+      elapsed += cycle();
+      continue;
+    }
+
+#if defined(GAMERBOY_JIT)
+    // RAM code can rewrite itself, only ROM blocks are recompiled.
+    if (block->native == nullptr && m_registers.pc < 0x8000 &&
+        ++block->executions == JIT_THRESHOLD) {
+      block->native = compile_block(*block, m_registers.pc);
+      if (block->native == nullptr) {
+        flush_native_blocks();
+        block->native = compile_block(*block, m_registers.pc);
+      }
+    }
+
+    // Native code can't stop halfway. Close to the deadline the block is
+    // interpreted instead, which stops at the deadline.
+    if (block->native != nullptr &&
+        elapsed + block->max_cycles <= m_batch_cycles) {
+      // Native code keeps F up to date itself.
+      get_flags();
+      elapsed += block->native(this, &m_registers);
+      elapsed += take_extra_cycles();
+      if (block->native_tail && !m_exit_block)
+        m_registers.pc = block->end;
+#if defined(GAMERBOY_IDLE_SKIP)
+      if (block->idle && m_registers.pc == address)
+        elapsed = skip_idle_loop(*block, block_start, elapsed);
+#endif
+      m_exit_block = false;
+      if (m_ram_code_written)
+        invalidate_ram_blocks();
+      continue;
+    }
+#endif
+
+    for (const DecodedInstruction &instruction : block->instructions) {
+      m_batch_elapsed = elapsed;
+      m_registers.pc += instruction.length;
+      m_immediate = instruction.immediate;
+      (this->*instruction.handler)(instruction.opcode);
+      elapsed += instruction.cycles + take_extra_cycles();
+
+      // Past the deadline the rest of the block waits for the next batch,
+      // so events aren't handled late.
+      if (m_exit_block || elapsed >= m_batch_cycles)
+        break;
+    }
+
+#if defined(GAMERBOY_IDLE_SKIP)
+    if (block->idle && m_registers.pc == address)
+      elapsed = skip_idle_loop(*block, block_start, elapsed);
+#endif
+
+    // `block` can't be used past this point.
+    m_exit_block = false;
+    if (m_ram_code_written)
+      invalidate_ram_blocks();
   }
-}
-
-void CPU::op_dec_lr(uint8_t opcode) {
-  uint8_t register_id = get_register(opcode);
-  uint8_t value = m_registers[register_id].get_lower_register() - 1;
-  m_registers[register_id].set_lower_register(value);
-
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
-
-  if ((m_registers[register_id] & 0x0F) == 0) {
-    m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, true);
+  return elapsed;
+}
+
+CPU::Block *CPU::get_block(uint16_t address) {
+  if (address >= 0x8000 && !is_cached_ram(address))
+    return nullptr;
+
+  uint32_t key = (m_memory.get_rom_bank(address) << 16) | address;
+  if (auto it = m_blocks.find(key); it != m_blocks.end())
+    return &it->second;
+
+  Block block = decode_block(address);
+  if (block.instructions.empty())
+    return nullptr;
+
+  return &m_blocks.emplace(key, std::move(block)).first->second;
+}
+
+CPU::Block CPU::decode_block(uint16_t address) {
+  // A block never leaves the region, or ROM bank, it started in.
+  uint32_t end;
+  if (m_memory.get_rom_bank(address) == BOOT_ROM_BANK)
+    end = 0x100;
+  else if (address < 0x4000)
+    end = 0x4000;
+  else if (address < 0x8000)
+    end = 0x8000;
+  else if (address < 0xE000)
+    end = 0xE000;
+  else
+    end = 0xFFFF;
+
+  Block block;
+  uint32_t pc = address;
+  while (block.instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+    uint8_t opcode = read_memory(pc);
+    uint8_t length = OPCODE_LENGTH[opcode];
+    if (pc + length > end)
+      break;
+
+    DecodedInstruction instruction{opcode_table[opcode], 0, opcode, length,
+                                   OPCODE_CYCLES[opcode], false};
+    if (length > 1)
+      instruction.immediate = read_memory(pc + 1);
+    if (length > 2)
+      instruction.immediate |= read_memory(pc + 2) << 8;
+
+    // Resolve CB opcodes up front, the prefix is never dispatched.
+    if (opcode == 0xCB) {
+      instruction.opcode = instruction.immediate;
+      instruction.handler = cb_opcode_table[instruction.opcode];
+      instruction.cycles = CB_OPCODE_CYCLES[instruction.opcode];
+      instruction.prefixed = true;
+    }
+
+    block.instructions.push_back(instruction);
+#if defined(GAMERBOY_JIT)
+    block.max_cycles += instruction.cycles;
+#endif
+
+    for (uint32_t i = pc; i < pc + length; i++)
+      if (is_cached_ram(i))
+        m_ram_code.set(i);
+
+    pc += length;
+    if (ends_block(opcode))
+      break;
   }
 
-  if ((m_registers[register_id] & 0xFF) == 0) {
-    m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, true);
+#if defined(GAMERBOY_IDLE_SKIP)
+  block.idle = is_idle_loop(block, address);
+#endif
+#if defined(GAMERBOY_JIT)
+  block.end = pc;
+  // A taken call or return is the most a branch can add.
+  block.max_cycles += CALL_TAKEN_CYCLES;
+#endif
+  return block;
+}
+
+#if defined(GAMERBOY_IDLE_SKIP)
+// Longest polling loop that gets skipped, including the branch.
+constexpr std::size_t MAX_IDLE_LOOP_INSTRUCTIONS = 4;
+
+// A loop that waits on memory, like `ldh a,(0x44) / cp 0x90 / jr nz`: it
+// reads memory first, branches back to its own start and writes nothing but
+// A and F. Every pass computes the same thing until the memory it reads
+// changes.
+bool CPU::is_idle_loop(const Block &block, uint16_t address) {
+  const std::vector<DecodedInstruction> &instructions = block.instructions;
+  if (instructions.size() < 2 ||
+      instructions.size() > MAX_IDLE_LOOP_INSTRUCTIONS)
+    return false;
+
+  uint16_t end = address;
+  for (const DecodedInstruction &instruction : instructions)
+    end += instruction.length;
+
+  const DecodedInstruction &branch = instructions.back();
+  uint16_t target;
+  switch (branch.prefixed ? 0x00 : branch.opcode) {
+  // jr cc,r8
+  case 0x20:
+  case 0x28:
+  case 0x30:
+  case 0x38:
+    target = end + static_cast<int8_t>(branch.immediate);
+    break;
+  // jp cc,a16
+  case 0xC2:
+  case 0xCA:
+  case 0xD2:
+  case 0xDA:
+    target = branch.immediate;
+    break;
+  default:
+    return false;
+  }
+  if (target != address)
+    return false;
+
+  const DecodedInstruction &load = instructions.front();
+  bool loads_a = !load.prefixed;
+  if (load.prefixed) {
+    // bit n,(hl)
+    if (load.opcode < 0x40 || load.opcode >= 0x80 ||
+        get_operand(load.opcode) != Operand::DHL)
+      return false;
+  } else {
+    switch (load.opcode) {
+    // ldh a,(a8), ld a,(a16), ld a,(hl), ld a,(bc), ld a,(de)
+    case 0xF0:
+    case 0xFA:
+    case 0x7E:
+    case 0x0A:
+    case 0x1A:
+      break;
+    default:
+      return false;
+    }
   }
-}
-
-// Opcode: 0xE0
-// write to io-port n (memory FF00+n)
-void CPU::op_ld_da8_a(uint8_t opcode) {
-  uint16_t address = 0xFF00 + m_memory.read_memory(m_pc++);
-  uint8_t reg = m_registers[Registers::AF] >> 8;
-  write_memory(address, reg);
-}
-
-// Opcode: 0x41
-void CPU::op_ld_b_c(uint8_t opcode) {
-  uint8_t c = m_registers[Registers::BC].get_lower_register();
-  m_registers[Registers::BC].set_upper_register(c);
-}
-
-// Opcode: 0x42
-void CPU::op_ld_b_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::BC].set_upper_register(d);
-}
-
-// Opcode: 0x43
-void CPU::op_ld_b_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::BC].set_upper_register(e);
-}
-
-// Opcode: 0x44
-void CPU::op_ld_b_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-
-  m_registers[Registers::BC].set_upper_register(h);
-}
-
-// Opcode: 0x45
-void CPU::op_ld_b_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::BC].set_upper_register(l);
-}
 
-// Opcode: 0x46
-void CPU::op_ld_b_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::BC].set_upper_register(value);
-}
+  for (std::size_t i = 1; i + 1 < instructions.size(); i++) {
+    uint8_t opcode = instructions[i].opcode;
+    if (instructions[i].prefixed) {
+      // bit n,a
+      if (opcode >= 0x40 && opcode < 0x80 &&
+          get_operand(opcode) == Operand::A && loads_a)
+        continue;
+      return false;
+    }
+
+    // and d8, cp d8
+    if (opcode == 0xE6 || opcode == 0xFE) {
+      if (!loads_a)
+        return false;
+      continue;
+    }
+
+    // and r, cp r, only the first instruction reads memory
+    bool and_r = opcode >= 0xA0 && opcode < 0xA8;
+    bool cp_r = opcode >= 0xB8 && opcode < 0xC0;
+    if (!loads_a || !(and_r || cp_r) || get_operand(opcode) == Operand::DHL)
+      return false;
+  }
+  return true;
+}
+
+// Another pass reads the same memory again. Only an event or the time
+// passing can change it, skip ahead to whichever comes first. The change is
+// looked for from when the pass read memory, it can come before the end.
+uint64_t CPU::skip_idle_loop(const Block &block, uint64_t start,
+                             uint64_t elapsed) {
+  const DecodedInstruction &load = block.instructions.front();
+  uint16_t address;
+  switch (load.prefixed ? 0x7E : load.opcode) {
+  case 0xF0:
+    address = 0xFF00 | (load.immediate & 0xFF);
+    break;
+  case 0xFA:
+    address = load.immediate;
+    break;
+  case 0x0A:
+    address = m_registers[BC];
+    break;
+  case 0x1A:
+    address = m_registers[DE];
+    break;
+  default:
+    address = m_registers[HL];
+    break;
+  }
 
-// Opcode: 0x47
-void CPU::op_ld_b_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::BC].set_upper_register(a);
+  uint64_t change = m_memory.next_change(address, m_cycles + start);
+  return std::max(elapsed, std::min(m_batch_cycles, change - m_cycles));
 }
+#endif
 
-// Opcode: 0x48
-void CPU::op_ld_c_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::BC].set_lower_register(b);
+void CPU::invalidate_ram_blocks() {
+  std::erase_if(m_blocks, [](const auto &entry) {
+    return is_cached_ram(entry.first & 0xFFFF);
+  });
+  m_ram_code.reset();
+  m_ram_code_written = false;
 }
 
-// Opcode: 0x4A
-void CPU::op_ld_c_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::BC].set_lower_register(d);
-}
+#elif defined(GAMERBOY_THREADED_DISPATCH) && defined(__clang__)
 
-// Opcode: 0x4B
-void CPU::op_ld_c_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::BC].set_lower_register(e);
-}
+template <uint8_t opcode>
+uint64_t CPU::threaded_handler(CPU &cpu, uint64_t elapsed) {
+  cpu.m_batch_elapsed = elapsed;
+  if constexpr (opcode == 0xCB) {
+    uint8_t cb_opcode = cpu.read_memory(cpu.m_registers.pc++);
+    [[clang::musttail]] return threaded_cb_table[cb_opcode](cpu, elapsed);
+  }
 
-// Opcode: 0x4C
-void CPU::op_ld_c_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  m_registers[Registers::BC].set_lower_register(h);
-}
+  cpu.fetch_immediate(opcode);
+  (cpu.*opcode_table[opcode])(opcode);
+  elapsed += OPCODE_CYCLES[opcode] + cpu.take_extra_cycles();
+  if (elapsed >= cpu.m_batch_cycles)
+    return elapsed;
 
-// Opcode: 0x4D
-void CPU::op_ld_c_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::BC].set_lower_register(l);
+  uint8_t next = cpu.read_memory(cpu.m_registers.pc++);
+  [[clang::musttail]] return threaded_table[next](cpu, elapsed);
 }
 
-// Opcode: 0x4E
-void CPU::op_ld_c_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::BC].set_lower_register(value);
-}
+template <uint8_t opcode>
+uint64_t CPU::threaded_cb_handler(CPU &cpu, uint64_t elapsed) {
+  (cpu.*cb_opcode_table[opcode])(opcode);
+  elapsed += CB_OPCODE_CYCLES[opcode];
+  if (elapsed >= cpu.m_batch_cycles)
+    return elapsed;
 
-// Opcode: 0x4F
-void CPU::op_ld_c_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::BC].set_lower_register(a);
+  uint8_t next = cpu.read_memory(cpu.m_registers.pc++);
+  [[clang::musttail]] return threaded_table[next](cpu, elapsed);
 }
 
-// Opcode: 0x50
-void CPU::op_ld_d_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::BC].set_lower_register(b);
-}
+constinit const std::array<CPU::threaded_handler_t, 256> CPU::threaded_table =
+    []<std::size_t... opcode>(std::index_sequence<opcode...>) {
+      return std::array<threaded_handler_t, 256>{
+          &CPU::threaded_handler<opcode>...};
+    }(std::make_index_sequence<256>{});
 
-// Opcode: 0x51
-void CPU::op_ld_d_c(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::DE].set_upper_register(d);
-}
+constinit const std::array<CPU::threaded_handler_t, 256>
+    CPU::threaded_cb_table =
+        []<std::size_t... opcode>(std::index_sequence<opcode...>) {
+          return std::array<threaded_handler_t, 256>{
+              &CPU::threaded_cb_handler<opcode>...};
+        }(std::make_index_sequence<256>{});
 
-// Opcode: 0x53
-void CPU::op_ld_d_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::DE].set_upper_register(e);
+uint64_t CPU::run() {
+  uint8_t opcode = read_memory(m_registers.pc++);
+  return threaded_table[opcode](*this, 0);
 }
 
-// Opcode: 0x54
-void CPU::op_ld_d_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  m_registers[Registers::DE].set_upper_register(h);
-}
+#elif defined(GAMERBOY_THREADED_DISPATCH) && defined(__GNUC__)
 
-// Opcode: 0x55
-void CPU::op_ld_d_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::DE].set_upper_register(l);
-}
+// Expands `M` once for every opcode, `0x00` through `0xFF`.
+// clang-format off
+#define GB_OPCODES_16(M, hi)                                                   \
+  M(hi##0) M(hi##1) M(hi##2) M(hi##3) M(hi##4) M(hi##5) M(hi##6) M(hi##7)      \
+  M(hi##8) M(hi##9) M(hi##A) M(hi##B) M(hi##C) M(hi##D) M(hi##E) M(hi##F)
+#define GB_OPCODES(M)                                                          \
+  GB_OPCODES_16(M, 0x0) GB_OPCODES_16(M, 0x1) GB_OPCODES_16(M, 0x2)            \
+  GB_OPCODES_16(M, 0x3) GB_OPCODES_16(M, 0x4) GB_OPCODES_16(M, 0x5)            \
+  GB_OPCODES_16(M, 0x6) GB_OPCODES_16(M, 0x7) GB_OPCODES_16(M, 0x8)            \
+  GB_OPCODES_16(M, 0x9) GB_OPCODES_16(M, 0xA) GB_OPCODES_16(M, 0xB)            \
+  GB_OPCODES_16(M, 0xC) GB_OPCODES_16(M, 0xD) GB_OPCODES_16(M, 0xE)            \
+  GB_OPCODES_16(M, 0xF)
+// clang-format on
 
-// Opcode: 0x56
-void CPU::op_ld_d_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::DE].set_upper_register(value);
+// Threaded engine, every handler fetches the next opcode and jumps straight
+// to its label so each one gets its own indirect branch.
+uint64_t CPU::run() {
+#define GB_LABEL(op) &&handler_##op,
+#define GB_CB_LABEL(op) &&cb_handler_##op,
+  static void *const labels[256] = {GB_OPCODES(GB_LABEL)};
+  static void *const cb_labels[256] = {GB_OPCODES(GB_CB_LABEL)};
+#undef GB_CB_LABEL
+#undef GB_LABEL
+
+  uint64_t elapsed = 0;
+  uint8_t opcode;
+
+#define GB_DISPATCH()                                                          \
+  do {                                                                         \
+    if (elapsed >= m_batch_cycles)                                             \
+      return elapsed;                                                          \
+    m_batch_elapsed = elapsed;                                                 \
+    opcode = read_memory(m_registers.pc++);                                    \
+    goto *labels[opcode];                                                      \
+  } while (0)
+
+// The CB prefix jumps straight into the CB handlers instead of going through
+// `op_prefix_cb`.
+#define GB_HANDLER(op)                                                         \
+  handler_##op : if (op == 0xCB) {                                             \
+    opcode = read_memory(m_registers.pc++);                                    \
+    goto *cb_labels[opcode];                                                   \
+  }                                                                            \
+  fetch_immediate(op);                                                         \
+  (this->*opcode_table[op])(op);                                               \
+  elapsed += OPCODE_CYCLES[op] + take_extra_cycles();                          \
+  GB_DISPATCH();
+
+#define GB_CB_HANDLER(op)                                                      \
+  cb_handler_##op : (this->*cb_opcode_table[op])(op);                         \
+  elapsed += CB_OPCODE_CYCLES[op];                                             \
+  GB_DISPATCH();
+
+  GB_DISPATCH();
+  GB_OPCODES(GB_HANDLER)
+  GB_OPCODES(GB_CB_HANDLER)
+
+#undef GB_CB_HANDLER
+#undef GB_HANDLER
+#undef GB_DISPATCH
+}
+
+#undef GB_OPCODES
+#undef GB_OPCODES_16
+
+#else
+
+uint64_t CPU::run() {
+  uint64_t elapsed = 0;
+  while (elapsed < m_batch_cycles) {
+    m_batch_elapsed = elapsed;
+    elapsed += cycle();
+  }
+  return elapsed;
 }
 
-// Opcode: 0x57
-void CPU::op_ld_d_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::DE].set_upper_register(a);
-}
+#endif
 
-// Opcode: 0x58
-void CPU::op_ld_e_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::DE].set_lower_register(b);
+uint8_t CPU::read_memory(uint16_t address) {
+  uint8_t ret = m_memory.read_memory(address);
+  return ret;
 }
 
-// Opcode: 0x59
-void CPU::op_ld_e_c(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::DE].set_lower_register(d);
-}
+void CPU::write_memory(uint16_t address, uint8_t value) {
+  m_memory.write_memory(address, value);
 
-// Opcode: 0x5A
-void CPU::op_ld_e_d(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::DE].set_lower_register(e);
+#if defined(GAMERBOY_BLOCK_CACHE)
+  // Writes to ROM can switch banks and writes to cached RAM code make the
+  // rest of the running block stale. Echo RAM writes go to WRAM, where the
+  // code is cached.
+  if (address >= 0xE000 && address < 0xFE00)
+    address -= 0x2000;
+  if (address < 0x8000) {
+    m_exit_block = true;
+  } else if (m_ram_code[address]) {
+    m_ram_code_written = true;
+    m_exit_block = true;
+  }
+#elif defined(GAMERBOY_AOT)
+  // Writes to ROM can switch banks under the translated block.
+  if (address < 0x8000)
+    m_exit_block = true;
+#endif
 }
 
-// Opcode: 0x5C
-void CPU::op_ld_e_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  m_registers[Registers::DE].set_lower_register(h);
+void CPU::fetch_immediate(uint8_t opcode) {
+  switch (OPCODE_LENGTH[opcode]) {
+  case 2:
+    m_immediate = read_memory(m_registers.pc++);
+    break;
+  case 3:
+    m_immediate = read_memory(m_registers.pc++);
+    m_immediate |= read_memory(m_registers.pc++) << 8;
+    break;
+  }
 }
 
-// Opcode: 0x5D
-void CPU::op_ld_e_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::DE].set_lower_register(l);
+void CPU::push(uint16_t value) {
+  m_registers[Registers::SP]--;
+  write_memory(m_registers[Registers::SP], value >> 8);
+  m_registers[Registers::SP]--;
+  write_memory(m_registers[Registers::SP], value & 0xFF);
+}
+
+uint16_t CPU::pop() {
+  uint16_t value = read_memory(m_registers[Registers::SP]++);
+  value |= read_memory(m_registers[Registers::SP]++) << 8;
+  return value;
+}
+
+template <uint8_t opcode> bool CPU::condition_code() {
+  if constexpr (get_conditional_code(opcode) == 0)
+    return !get_zero();
+  else if constexpr (get_conditional_code(opcode) == 1)
+    return get_zero();
+  else if constexpr (get_conditional_code(opcode) == 2)
+    return !get_carry();
+  else
+    return get_carry();
+}
+
+template <Operand r> uint8_t CPU::read_operand() {
+  if constexpr (r == Operand::B)
+    return m_registers[Registers::BC].get_upper_register();
+  else if constexpr (r == Operand::C)
+    return m_registers[Registers::BC].get_lower_register();
+  else if constexpr (r == Operand::D)
+    return m_registers[Registers::DE].get_upper_register();
+  else if constexpr (r == Operand::E)
+    return m_registers[Registers::DE].get_lower_register();
+  else if constexpr (r == Operand::H)
+    return m_registers[Registers::HL].get_upper_register();
+  else if constexpr (r == Operand::L)
+    return m_registers[Registers::HL].get_lower_register();
+  else if constexpr (r == Operand::DHL)
+    return read_memory(m_registers[Registers::HL]);
+  else
+    return m_registers[Registers::AF].get_upper_register();
+}
+
+template <Operand r> void CPU::write_operand(uint8_t value) {
+  if constexpr (r == Operand::B)
+    m_registers[Registers::BC].set_upper_register(value);
+  else if constexpr (r == Operand::C)
+    m_registers[Registers::BC].set_lower_register(value);
+  else if constexpr (r == Operand::D)
+    m_registers[Registers::DE].set_upper_register(value);
+  else if constexpr (r == Operand::E)
+    m_registers[Registers::DE].set_lower_register(value);
+  else if constexpr (r == Operand::H)
+    m_registers[Registers::HL].set_upper_register(value);
+  else if constexpr (r == Operand::L)
+    m_registers[Registers::HL].set_lower_register(value);
+  else if constexpr (r == Operand::DHL)
+    write_memory(m_registers[Registers::HL], value);
+  else
+    m_registers[Registers::AF].set_upper_register(value);
 }
 
-// Opcode: 0x5E
-void CPU::op_ld_e_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::DE].set_lower_register(value);
-}
+// Opcode: 0x00
+// Flags: ----
+// No operation
+void CPU::op_nop(uint8_t opcode) {}
 
-// Opcode: 0x5F
-void CPU::op_ld_e_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::DE].set_lower_register(a);
+// Opcodes: 0xD3, 0xDB, 0xDD, 0xE3, 0xE4, 0xEB, 0xEC, 0xED, 0xF4, 0xFC, 0xFD
+// These don't exist on the SM83, real hardware locks up when it hits one.
+// Only these 11 undefined opcodes map here, every other one has a handler.
+void CPU::op_illegal(uint8_t opcode) {
+  std::cerr << "Illegal opcode 0x" << std::hex << +opcode << " at 0x"
+            << static_cast<uint16_t>(m_registers.pc - 1) << std::endl;
+  utility::error("CPU locked up!", 4);
 }
 
-// Opcode: 0x60
-void CPU::op_ld_h_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::HL].set_lower_register(b);
+// Opcode: x1
+// Flags: ----
+// rr=nn ; rr may be BC,DE,HL,SP
+template <uint8_t opcode> void CPU::op_ld_rr_d16(uint8_t) {
+  m_registers[get_register(opcode)] = read_d16();
 }
 
-// Opcode: 0x61
-void CPU::op_ld_h_c(uint8_t opcode) {
-  uint8_t c = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::HL].set_upper_register(c);
+// Opcode: x02, 0x12
+// Flags: ----
+// (BC)=A && (DE)=A
+template <uint8_t opcode> void CPU::op_ld_drr_a(uint8_t) {
+  write_memory(m_registers[get_register(opcode)],
+               m_registers[Registers::AF].get_upper_register());
 }
 
-// Opcode: 0x62
-void CPU::op_ld_h_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::HL].set_upper_register(d);
+// Opcode: 0x0A, 0x1A
+// Flags: ----
+// A=(BC), A=(DE)
+template <uint8_t opcode> void CPU::op_ld_a_drr(uint8_t) {
+  m_registers[Registers::AF].set_upper_register(
+      read_memory(m_registers[get_register(opcode)]));
 }
 
-// Opcode: 0x63
-void CPU::op_ld_h_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::HL].set_upper_register(e);
+// Opcode: 0x22
+// Flags: ----
+// (HL)=A, HL=HL+1
+void CPU::op_ld_dhli_a(uint8_t opcode) {
+  write_memory(m_registers[Registers::HL],
+               m_registers[Registers::AF].get_upper_register());
+  m_registers[Registers::HL]++;
 }
 
-// Opcode: 0x65
-void CPU::op_ld_h_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::HL].set_upper_register(l);
+// Opcode: 0x2A
+// Flags: ----
+// A=[HL], HL=HL+1
+void CPU::op_ld_a_dhli(uint8_t opcode) {
+  m_registers[Registers::AF].set_upper_register(
+      read_memory(m_registers[Registers::HL]));
+  m_registers[Registers::HL]++;
 }
 
-// Opcode: 0x66
-void CPU::op_ld_h_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::HL].set_upper_register(value);
+// Opcode: 0x32
+// Flags: ----
+// (HL)=A, HL=HL-1
+void CPU::op_ld_dhld_a(uint8_t opcode) {
+  write_memory(m_registers[Registers::HL],
+               m_registers[Registers::AF].get_upper_register());
+  m_registers[Registers::HL]--;
 }
 
-// Opcode: 0x67
-void CPU::op_ld_h_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::HL].set_upper_register(a);
-}
-// Opcode: 0x68
-void CPU::op_ld_l_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::HL].set_lower_register(b);
+// Opcode: 0x3A
+// Flags: ----
+// A=[HL], HL=HL-1
+void CPU::op_ld_a_dhld(uint8_t opcode) {
+  m_registers[Registers::AF].set_upper_register(
+      read_memory(m_registers[Registers::HL]));
+  m_registers[Registers::HL]--;
 }
 
-// Opcode: 0x69
-void CPU::op_ld_l_c(uint8_t opcode) {
-  uint8_t c = m_registers[Registers::BC].get_lower_register();
-  m_registers[Registers::HL].set_lower_register(c);
+// Opcode: 0x08
+// Flags: ----
+// (nn)=SP
+void CPU::op_ld_da16_sp(uint8_t opcode) {
+  uint16_t address = read_d16();
+  write_memory(address, m_registers[Registers::SP] & 0xFF);
+  write_memory(address + 1, m_registers[Registers::SP] >> 8);
 }
 
-// Opcode: 0x6A
-void CPU::op_ld_l_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::HL].set_lower_register(d);
+// Opcode: x6, xE
+// Flags: ----
+// r=n
+template <uint8_t opcode> void CPU::op_ld_r_d8(uint8_t) {
+  write_operand<get_operand(opcode >> 3)>(read_d8());
 }
 
-// Opcode: 0x6B
-void CPU::op_ld_l_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::HL].set_lower_register(e);
-}
+// Opcode: 0x40 - 0x7F, except 0x76
+// Flags: ----
+// r=r
+template <uint8_t opcode> void CPU::op_ld_r_r(uint8_t) {
+  constexpr Operand dst = get_operand(opcode >> 3);
+  constexpr Operand src = get_operand(opcode);
 
-// Opcode: 0x6C
-void CPU::op_ld_l_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  m_registers[Registers::HL].set_lower_register(h);
+  if constexpr (dst != src)
+    write_operand<dst>(read_operand<src>());
 }
 
-// Opcode: 0x6E
-void CPU::op_ld_l_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::HL].set_lower_register(value);
+// Opcode: 0xE0
+// write to io-port n (memory FF00+n)
+void CPU::op_ld_da8_a(uint8_t opcode) {
+  uint16_t address = 0xFF00 + read_d8();
+  write_memory(address, m_registers[Registers::AF].get_upper_register());
 }
 
-// Opcode: 0x6F
-void CPU::op_ld_l_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  m_registers[Registers::HL].set_lower_register(a);
+// Opcode: 0xF0
+// read from io-port n (memory FF00+n)
+void CPU::op_ld_a_da8(uint8_t opcode) {
+  uint16_t address = 0xFF00 + read_d8();
+  m_registers[Registers::AF].set_upper_register(read_memory(address));
 }
 
-// Opcode: 0x70
-void CPU::op_ld_dhl_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  write_memory(m_registers[Registers::HL], b);
+// Opcode: 0xE2
+// write to io-port C (memory FF00+C)
+void CPU::op_ld_dc_a(uint8_t opcode) {
+  uint16_t address = 0xFF00 + m_registers[Registers::BC].get_lower_register();
+  write_memory(address, m_registers[Registers::AF].get_upper_register());
 }
 
-// Opcode: 0x71
-void CPU::op_ld_dhl_c(uint8_t opcode) {
-  uint8_t c = m_registers[Registers::DE].get_upper_register();
-  write_memory(m_registers[Registers::HL], c);
+// Opcode: 0xF2
+// read from io-port C (memory FF00+C)
+void CPU::op_ld_a_dc(uint8_t opcode) {
+  uint16_t address = 0xFF00 + m_registers[Registers::BC].get_lower_register();
+  m_registers[Registers::AF].set_upper_register(read_memory(address));
 }
 
-// Opcode: 0x72
-void CPU::op_ld_dhl_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  write_memory(m_registers[Registers::HL], d);
+// Opcode: 0xEA
+// (nn)=A
+void CPU::op_ld_da16_a(uint8_t opcode) {
+  write_memory(read_d16(), m_registers[Registers::AF].get_upper_register());
 }
 
-// Opcode: 0x73
-void CPU::op_ld_dhl_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  write_memory(m_registers[Registers::HL], e);
+// Opcode: 0xFA
+// A=(nn)
+void CPU::op_ld_a_da16(uint8_t opcode) {
+  m_registers[Registers::AF].set_upper_register(read_memory(read_d16()));
 }
 
-// Opcode: 0x74
-void CPU::op_ld_dhl_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  write_memory(m_registers[Registers::HL], h);
+// Opcode: 0xF8
+// Flags: 00hc
+// HL=SP+r8
+void CPU::op_ld_hl_sp_r8(uint8_t opcode) {
+  m_registers[Registers::HL] = add_sp_r8();
 }
 
-// Opcode: 0x75
-void CPU::op_ld_dhl_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  write_memory(m_registers[Registers::HL], l);
+// Opcode: 0xF9
+// SP=HL
+void CPU::op_ld_sp_hl(uint8_t opcode) {
+  m_registers[Registers::SP] = m_registers[Registers::HL].get_word();
 }
 
-// Opcode: 0x77
-void CPU::op_ld_dhl_a(uint8_t opcode) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  write_memory(m_registers[Registers::HL], a);
+// Opcode: x5
+// SP=SP-2, (SP)=rr ; rr may be BC,DE,HL,AF
+template <uint8_t opcode> void CPU::op_push_rr(uint8_t) {
+  if constexpr (get_stack_register(opcode) == Registers::AF)
+    get_flags();
+  push(m_registers[get_stack_register(opcode)]);
 }
 
-// Opcode: 0x78
-void CPU::op_ld_a_b(uint8_t opcode) {
-  uint8_t b = m_registers[Registers::BC].get_upper_register();
-  m_registers[Registers::AF].set_upper_register(b);
+// Opcode: x1
+// rr=(SP), SP=SP+2 ; rr may be BC,DE,HL,AF
+template <uint8_t opcode> void CPU::op_pop_rr(uint8_t) {
+  constexpr uint8_t register_id = get_stack_register(opcode);
+
+  // The lower nibble of F is always zero.
+  if constexpr (register_id == Registers::AF) {
+    uint16_t af = pop();
+    m_registers[register_id].set_upper_register(af >> 8);
+    set_flags(af & 0xF0);
+  } else {
+    m_registers[register_id] = pop();
+  }
 }
 
-// Opcode: 0x79
-void CPU::op_ld_a_c(uint8_t opcode) {
-  uint8_t c = m_registers[Registers::BC].get_lower_register();
-  m_registers[Registers::AF].set_upper_register(c);
+// Opcode: x3
+// rr = rr+1 ; rr may be BC,DE,HL,SP
+template <uint8_t opcode> void CPU::op_inc_rr(uint8_t) {
+  m_registers[get_register(opcode)]++;
 }
 
-// Opcode: 0x7A
-void CPU::op_ld_a_d(uint8_t opcode) {
-  uint8_t d = m_registers[Registers::DE].get_upper_register();
-  m_registers[Registers::AF].set_upper_register(d);
+// Opcode: xB
+// rr = rr-1 ; rr may be BC,DE,HL,SP
+template <uint8_t opcode> void CPU::op_dec_rr(uint8_t) {
+  m_registers[get_register(opcode)]--;
 }
 
-// Opcode: 0x7B
-void CPU::op_ld_a_e(uint8_t opcode) {
-  uint8_t e = m_registers[Registers::DE].get_lower_register();
-  m_registers[Registers::AF].set_upper_register(e);
-}
+// Opcode: x4, xC
+// Flags: z0h-
+// r=r+1
+template <uint8_t opcode> void CPU::op_inc_r(uint8_t) {
+  constexpr Operand r = get_operand(opcode >> 3);
+  uint8_t value = read_operand<r>();
+  uint8_t result = value + 1;
+  write_operand<r>(result);
 
-// Opcode: 0x7C
-void CPU::op_ld_a_h(uint8_t opcode) {
-  uint8_t h = m_registers[Registers::HL].get_upper_register();
-  m_registers[Registers::AF].set_upper_register(h);
+  // The carry flag is left alone.
+  set_alu_flags(FlagOperation::ADD, value, 1, result | (get_carry() << 8));
 }
 
-// Opcode: 0x7D
-void CPU::op_ld_a_l(uint8_t opcode) {
-  uint8_t l = m_registers[Registers::HL].get_lower_register();
-  m_registers[Registers::AF].set_upper_register(l);
-}
+// Opcode: x5, xD
+// Flags: z1h-
+// r=r-1
+template <uint8_t opcode> void CPU::op_dec_r(uint8_t) {
+  constexpr Operand r = get_operand(opcode >> 3);
+  uint8_t value = read_operand<r>();
+  uint8_t result = value - 1;
+  write_operand<r>(result);
 
-// Opcode: 0x7E
-void CPU::op_ld_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  m_registers[Registers::AF].set_upper_register(value);
+  // The carry flag is left alone.
+  set_alu_flags(FlagOperation::SUB, value, 1, result | (get_carry() << 8));
 }
 
 // Opcode: 0x07
@@ -625,7 +999,7 @@ void CPU::op_ld_a_dhl(uint8_t opcode) {
 // Rotate A left
 void CPU::op_rlca(uint8_t opcode) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
+  uint8_t f = 0;
 
   // Check highest bit of `a`
   bool carry = ((a & 0x80) != 0);
@@ -633,15 +1007,13 @@ void CPU::op_rlca(uint8_t opcode) {
   // Shift a over by 1 bit
   a <<= 1;
 
-  // Clear out flags
-  f &= 0x00;
-
   if (carry) {
     a |= 0x01;
     f |= Flags::CARRY_FLAG;
   }
 
-  m_registers[Registers::AF].set_word(a, f);
+  m_registers[Registers::AF].set_upper_register(a);
+  set_flags(f);
 }
 
 // Opcode: 0x17
@@ -649,17 +1021,14 @@ void CPU::op_rlca(uint8_t opcode) {
 // Rotate A left through carry
 void CPU::op_rla(uint8_t opcode) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
+  uint8_t f = 0;
 
   // Check highest bit of `a`
   bool most_sig_bit = (a & 0x80) != 0;
-  bool carry_bit = (f & Flags::CARRY_FLAG) != 0;
+  bool carry_bit = get_carry();
 
   // Shift a over by 1 bit
   a <<= 1;
-  // Clear out flags
-  f &= 0x00;
-
   if (carry_bit) {
     a |= 0x01;
   }
@@ -667,7 +1036,8 @@ void CPU::op_rla(uint8_t opcode) {
     f |= Flags::CARRY_FLAG;
   }
 
-  m_registers[Registers::AF].set_word(a, f);
+  m_registers[Registers::AF].set_upper_register(a);
+  set_flags(f);
 }
 
 // Opcode: 0x0F
@@ -675,7 +1045,7 @@ void CPU::op_rla(uint8_t opcode) {
 // Rotate A right
 void CPU::op_rrca(uint8_t opcode) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
+  uint8_t f = 0;
 
   // Check lowest bit of `a`
   bool carry = ((a & 0x01) != 0);
@@ -683,15 +1053,13 @@ void CPU::op_rrca(uint8_t opcode) {
   // Shift a over by 1 bit
   a >>= 1;
 
-  // Clear out flags
-  f &= 0x00;
-
   if (carry) {
     a |= 0x80;
     f |= Flags::CARRY_FLAG;
   }
 
-  m_registers[Registers::AF].set_word(a, f);
+  m_registers[Registers::AF].set_upper_register(a);
+  set_flags(f);
 }
 
 // Opcode: 0x1F
@@ -699,18 +1067,15 @@ void CPU::op_rrca(uint8_t opcode) {
 // Rotate A right through carry
 void CPU::op_rra(uint8_t opcode) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
+  uint8_t f = 0;
 
   // Check lowest bit of `a`
   bool lowest_sig_bit = ((a & 0x01) != 0);
-  bool carry_bit = (f & Flags::CARRY_FLAG) != 0;
+  bool carry_bit = get_carry();
 
   // Shift a over by 1 bit
   a >>= 1;
 
-  // Clear out flags
-  f &= 0x00;
-
   if (carry_bit) {
     a |= 0x80;
   }
@@ -719,436 +1084,95 @@ void CPU::op_rra(uint8_t opcode) {
     f |= Flags::CARRY_FLAG;
   }
 
-  m_registers[Registers::AF].set_word(a, f);
+  m_registers[Registers::AF].set_upper_register(a);
+  set_flags(f);
 }
 
 // Opcode: x9
 // Flags: -0hc
 // HL = HL+rr ; rr may be BC,DE,HL,SP
-void CPU::op_add_hl_rr(uint8_t opcode) {
-  int8_t register_id = get_register(opcode);
-  uint16_t rr = m_registers[register_id];
+template <uint8_t opcode> void CPU::op_add_hl_rr(uint8_t) {
+  uint16_t rr = m_registers[get_register(opcode)];
   uint16_t hl = m_registers[Registers::HL];
 
-  uint16_t result = hl + rr;
-
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG,
-                                      (result & 0x10000) != 0);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (rr & 0xFFF) + (hl + 0xFFF) > 0xFFF);
-  m_registers[Registers::HL].set_word(result);
-}
-
-void CPU::op_add_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  add_a_r(b);
-}
-
-void CPU::op_add_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  add_a_r(c);
-}
-
-void CPU::op_add_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  add_a_r(d);
-}
-
-void CPU::op_add_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  add_a_r(e);
-}
+  uint32_t result = hl + rr;
 
-void CPU::op_add_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  add_a_r(h);
+  set_flag(Flags::SUBTRACT_FLAG, false);
+  set_flag(Flags::CARRY_FLAG, (result & 0x10000) != 0);
+  set_flag(Flags::HALF_CARRY_FLAG, (rr & 0xFFF) + (hl & 0xFFF) > 0xFFF);
+  m_registers[Registers::HL].set_word(static_cast<uint16_t>(result));
 }
 
-void CPU::op_add_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  add_a_r(l);
+// Opcode: 0xE8
+// Flags: 00hc
+// SP = SP+r8
+void CPU::op_add_sp_r8(uint8_t opcode) {
+  m_registers[Registers::SP] = add_sp_r8();
 }
 
-void CPU::op_add_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  add_a_r(value);
+// Opcode: 0x80 - 0xBF
+// A=A op r
+template <uint8_t opcode> void CPU::op_alu_a_r(uint8_t) {
+  alu_a_r<(opcode >> 3) & 0x07>(read_operand<get_operand(opcode)>());
 }
 
-void CPU::op_add_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  add_a_r(a);
-}
-
-void CPU::op_adc_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  adc_a_r(b);
-}
-
-void CPU::op_adc_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  adc_a_r(c);
-}
-
-void CPU::op_adc_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  adc_a_r(d);
-}
-
-void CPU::op_adc_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  adc_a_r(e);
-}
-
-void CPU::op_adc_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  adc_a_r(h);
-}
-
-void CPU::op_adc_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  adc_a_r(l);
-}
-
-void CPU::op_adc_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  adc_a_r(value);
-}
-
-void CPU::op_adc_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  adc_a_r(a);
+// Opcode: 0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE
+// A=A op n
+template <uint8_t opcode> void CPU::op_alu_a_d8(uint8_t) {
+  alu_a_r<(opcode >> 3) & 0x07>(read_d8());
 }
 
 void CPU::add_a_r(uint8_t value) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a + value;
+  uint16_t result = a + value;
 
-  m_registers[Registers::AF].set_upper_register(result);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (a & 0xF) + (value & 0xF) > 0xF);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, (result & 0x100) != 0);
+  m_registers[Registers::AF].set_upper_register(result & 0xFF);
+  set_alu_flags(FlagOperation::ADD, a, value, result);
 }
 
 void CPU::adc_a_r(uint8_t value) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
-  uint8_t carry = (f & Flags::CARRY_FLAG) ? 0x60 : 0x00;
-
-  uint16_t word_result = a + value + carry;
-  uint8_t result = a + value + carry;
-
-  m_registers[Registers::AF].set_upper_register(result);
-
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (a & 0xF) + (value & 0xF) + carry > 0xF);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, word_result > 0xFF);
-}
-
-void CPU::op_sub_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  sub_a_r(b);
-}
-
-void CPU::op_sub_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  sub_a_r(c);
-}
-
-void CPU::op_sub_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  sub_a_r(d);
-}
-
-void CPU::op_sub_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  sub_a_r(e);
-}
-
-void CPU::op_sub_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  sub_a_r(h);
-}
-
-void CPU::op_sub_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  sub_a_r(l);
-}
-
-void CPU::op_sub_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  sub_a_r(value);
-}
-
-void CPU::op_sub_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  sub_a_r(a);
-}
-
-void CPU::op_sbc_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  sbc_a_r(b);
-}
-
-void CPU::op_sbc_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  sbc_a_r(c);
-}
-
-void CPU::op_sbc_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  sbc_a_r(d);
-}
-
-void CPU::op_sbc_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  sbc_a_r(e);
-}
+  uint16_t result = a + value + get_carry();
 
-void CPU::op_sbc_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  sbc_a_r(h);
-}
-
-void CPU::op_sbc_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  sbc_a_r(l);
-}
-
-void CPU::op_sbc_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  sbc_a_r(value);
-}
-
-void CPU::op_sbc_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  sbc_a_r(a);
+  m_registers[Registers::AF].set_upper_register(result & 0xFF);
+  set_alu_flags(FlagOperation::ADD, a, value, result);
 }
 
 void CPU::sub_a_r(uint8_t value) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a + value;
+  uint16_t result = a - value;
 
-  m_registers[Registers::AF].set_upper_register(result);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      (a & 0xF) - (value & 0xF) < 0x0);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, a < value);
+  m_registers[Registers::AF].set_upper_register(result & 0xFF);
+  set_alu_flags(FlagOperation::SUB, a, value, result);
 }
 
 void CPU::sbc_a_r(uint8_t value) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
-  uint8_t carry = (f & Flags::CARRY_FLAG) ? 0x60 : 0x00;
+  uint16_t result = a - value - get_carry();
 
-  int16_t word_result = a - value - carry;
-  uint8_t result = a - value - carry;
-
-  m_registers[Registers::AF].set_upper_register(result);
-
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, word_result < 0);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG,
-                                      ((a & 0xF) - (value & 0xF) - carry) < 0);
-}
-
-void CPU::op_and_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  and_a_r(b);
-}
-
-void CPU::op_and_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  and_a_r(c);
-}
-
-void CPU::op_and_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  sub_a_r(d);
-}
-
-void CPU::op_and_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  and_a_r(e);
-}
-
-void CPU::op_and_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  sub_a_r(h);
-}
-
-void CPU::op_and_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  and_a_r(l);
-}
-
-void CPU::op_and_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  and_a_r(value);
-}
-
-void CPU::op_and_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  and_a_r(a);
-}
-
-void CPU::op_xor_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  xor_a_r(b);
-}
-
-void CPU::op_xor_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  xor_a_r(c);
-}
-
-void CPU::op_xor_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  xor_a_r(d);
-}
-
-void CPU::op_xor_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  xor_a_r(e);
-}
-
-void CPU::op_xor_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  xor_a_r(h);
-}
-
-void CPU::op_xor_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  xor_a_r(l);
-}
-
-void CPU::op_xor_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  xor_a_r(value);
-}
-
-void CPU::op_xor_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  xor_a_r(a);
-}
-
-void CPU::op_or_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  or_a_r(b);
-}
-
-void CPU::op_or_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  or_a_r(c);
-}
-
-void CPU::op_or_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  or_a_r(d);
-}
-
-void CPU::op_or_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  or_a_r(e);
-}
-
-void CPU::op_or_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  or_a_r(h);
-}
-
-void CPU::op_or_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  or_a_r(l);
-}
-
-void CPU::op_or_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  or_a_r(value);
-}
-
-void CPU::op_or_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  or_a_r(a);
-}
-
-void CPU::op_cp_a_b(uint8_t opcode) {
-  int8_t b = m_registers[Registers::BC].get_upper_register();
-  cp_a_r(b);
-}
-
-void CPU::op_cp_a_c(uint8_t opcode) {
-  int8_t c = m_registers[Registers::BC].get_lower_register();
-  cp_a_r(c);
-}
-
-void CPU::op_cp_a_d(uint8_t opcode) {
-  int8_t d = m_registers[Registers::DE].get_upper_register();
-  cp_a_r(d);
-}
-
-void CPU::op_cp_a_e(uint8_t opcode) {
-  int8_t e = m_registers[Registers::DE].get_lower_register();
-  cp_a_r(e);
-}
-
-void CPU::op_cp_a_h(uint8_t opcode) {
-  int8_t h = m_registers[Registers::HL].get_upper_register();
-  cp_a_r(h);
-}
-
-void CPU::op_cp_a_l(uint8_t opcode) {
-  int8_t l = m_registers[Registers::HL].get_lower_register();
-  cp_a_r(l);
-}
-
-void CPU::op_cp_a_dhl(uint8_t opcode) {
-  uint8_t value = read_memory(m_registers[Registers::HL]);
-  cp_a_r(value);
-}
-
-void CPU::op_cp_a_a(uint8_t opcode) {
-  int8_t a = m_registers[Registers::AF].get_upper_register();
-  cp_a_r(a);
+  m_registers[Registers::AF].set_upper_register(result & 0xFF);
+  set_alu_flags(FlagOperation::SUB, a, value, result);
 }
 
 void CPU::and_a_r(uint8_t value) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a & value;
+  uint8_t result = m_registers[Registers::AF].get_upper_register() & value;
 
   m_registers[Registers::AF].set_upper_register(result);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, false);
+  set_alu_flags(FlagOperation::AND, result, 0, result);
 }
 
 void CPU::xor_a_r(uint8_t value) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a ^ value;
+  uint8_t result = m_registers[Registers::AF].get_upper_register() ^ value;
 
   m_registers[Registers::AF].set_upper_register(result);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, false);
+  set_alu_flags(FlagOperation::OR, result, 0, result);
 }
 
 void CPU::or_a_r(uint8_t value) {
-  uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a | value;
+  uint8_t result = m_registers[Registers::AF].get_upper_register() | value;
 
   m_registers[Registers::AF].set_upper_register(result);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, false);
+  set_alu_flags(FlagOperation::OR, result, 0, result);
 }
 
 // Compare A with n. This is basically an A - n
@@ -1156,13 +1180,23 @@ void CPU::or_a_r(uint8_t value) {
 // away.
 void CPU::cp_a_r(uint8_t value) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t result = a - value;
+  set_alu_flags(FlagOperation::SUB, a, value, a - value);
+}
+
+// SP+r8, shared by `add sp,r8` and `ld hl,sp+r8`. The flags come from the
+// unsigned addition of the low byte.
+uint16_t CPU::add_sp_r8() {
+  uint8_t offset = read_d8();
+  uint16_t sp = m_registers[Registers::SP];
 
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, result == 0);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG,
-                                      ((a & 0xF) - (value & 0xF) < 0));
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, a < value);
+  uint8_t f = 0;
+  if ((sp & 0xF) + (offset & 0xF) > 0xF)
+    f |= Flags::HALF_CARRY_FLAG;
+  if ((sp & 0xFF) + offset > 0xFF)
+    f |= Flags::CARRY_FLAG;
+  set_flags(f);
+
+  return sp + static_cast<int8_t>(offset);
 }
 
 // Opcode: 0x18
@@ -1170,43 +1204,112 @@ void CPU::cp_a_r(uint8_t value) {
 // relative jump to nn (PC=PC+8-bit signed)
 // jr PC+dd
 void CPU::op_jr_r8(uint8_t opcode) {
-  m_pc = static_cast<int8_t>(read_memory(m_pc) + 1);
+  int8_t offset = static_cast<int8_t>(read_d8());
+  m_registers.pc += offset;
 }
 
 // Opcode: 0x20, 0x28, 0x30, 0x38
 // Flags: ----
 // conditional jump if nz,z,nc,c
-void CPU::op_jr_cc_r8(uint8_t opcode) {
-  int8_t offset = static_cast<int8_t>(read_memory(m_pc++));
-  if (condition_code(opcode)) {
-    m_pc += offset;
+template <uint8_t opcode> void CPU::op_jr_cc_r8(uint8_t) {
+  int8_t offset = static_cast<int8_t>(read_d8());
+  if (condition_code<opcode>()) {
+    m_registers.pc += offset;
+    m_extra_cycles = JR_TAKEN_CYCLES;
+  }
+}
+
+// Opcode: 0xC3
+// jump to nn, PC=nn
+void CPU::op_jp_a16(uint8_t opcode) { m_registers.pc = read_d16(); }
+
+// Opcode: 0xE9
+// jump to HL, PC=HL
+void CPU::op_jp_hl(uint8_t opcode) {
+  m_registers.pc = m_registers[Registers::HL];
+}
+
+// Opcode: 0xC2, 0xCA, 0xD2, 0xDA
+// conditional jump if nz,z,nc,c
+template <uint8_t opcode> void CPU::op_jp_cc_a16(uint8_t) {
+  uint16_t address = read_d16();
+  if (condition_code<opcode>()) {
+    m_registers.pc = address;
+    m_extra_cycles = JP_TAKEN_CYCLES;
   }
 }
 
+// Opcode: 0xCD
+// call to nn, SP=SP-2, (SP)=PC, PC=nn
+void CPU::op_call_a16(uint8_t opcode) {
+  uint16_t address = read_d16();
+  push(m_registers.pc);
+  m_registers.pc = address;
+}
+
+// Opcode: 0xC4, 0xCC, 0xD4, 0xDC
+// conditional call if nz,z,nc,c
+template <uint8_t opcode> void CPU::op_call_cc_a16(uint8_t) {
+  uint16_t address = read_d16();
+  if (condition_code<opcode>()) {
+    push(m_registers.pc);
+    m_registers.pc = address;
+    m_extra_cycles = CALL_TAKEN_CYCLES;
+  }
+}
+
+// Opcode: 0xC9
+// return, PC=(SP), SP=SP+2
+void CPU::op_ret(uint8_t opcode) { m_registers.pc = pop(); }
+
+// Opcode: 0xD9
+// return and enable interrupts
+void CPU::op_reti(uint8_t opcode) {
+  m_registers.pc = pop();
+  m_registers.interrupt_enable = 1;
+  shorten_batch(0);
+}
+
+// Opcode: 0xC0, 0xC8, 0xD0, 0xD8
+// conditional return if nz,z,nc,c
+template <uint8_t opcode> void CPU::op_ret_cc(uint8_t) {
+  if (condition_code<opcode>()) {
+    m_registers.pc = pop();
+    m_extra_cycles = RET_TAKEN_CYCLES;
+  }
+}
+
+// Opcode: xF, x7 (0xC0 - 0xFF)
+// call to 00,08,10,18,20,28,30,38
+template <uint8_t opcode> void CPU::op_rst(uint8_t) {
+  push(m_registers.pc);
+  m_registers.pc = opcode & 0x38;
+}
+
 // Opcode: 0x27
 // Flags: z-0c
 // decimal adjust A
 void CPU::op_daa(uint8_t opcode) {
   uint8_t a = m_registers[Registers::AF].get_upper_register();
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
+  uint8_t f = get_flags();
 
-  uint8_t carry = (f & Flags::CARRY_FLAG) ? 0x60 : 0x00;
+  uint8_t correction = 0x00;
+  bool carry = (f & Flags::CARRY_FLAG);
   bool half_carry = (f & Flags::HALF_CARRY_FLAG);
   bool subtract = (f & Flags::SUBTRACT_FLAG);
 
-  if (!subtract) {
-    if ((a & 0x0F) > 0x09)
-      carry |= 0x06;
-    if (a > 0x99)
-      carry |= 0x60;
-    a += carry;
-  } else {
-    a -= carry;
+  if (half_carry || (!subtract && (a & 0x0F) > 0x09))
+    correction |= 0x06;
+  if (carry || (!subtract && a > 0x99)) {
+    correction |= 0x60;
+    carry = true;
   }
 
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, carry >= 0x60);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::ZERO_FLAG, a == 0x00);
+  a = subtract ? a - correction : a + correction;
+
+  set_flag(Flags::CARRY_FLAG, carry);
+  set_flag(Flags::HALF_CARRY_FLAG, false);
+  set_flag(Flags::ZERO_FLAG, a == 0x00);
 
   m_registers[Registers::AF].set_upper_register(a);
 }
@@ -1218,29 +1321,142 @@ void CPU::op_cpl(uint8_t opcode) {
   uint8_t a = ~(m_registers[Registers::AF].get_upper_register());
   m_registers[Registers::AF].set_upper_register(a);
 
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, true);
+  set_flag(Flags::HALF_CARRY_FLAG, true);
+  set_flag(Flags::SUBTRACT_FLAG, true);
 }
 
 // Opcode: 0x37
 // Flags: -001
 void CPU::op_scf(uint8_t opcode) {
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, true);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
+  set_flag(Flags::CARRY_FLAG, true);
+  set_flag(Flags::HALF_CARRY_FLAG, false);
+  set_flag(Flags::SUBTRACT_FLAG, false);
 }
 
 // Opcode: 0x3F
 // Flags: -00c
 // cy=cy xor 1
 void CPU::op_ccf(uint8_t opcode) {
-  uint8_t f = m_registers[Registers::AF].get_lower_register();
-  bool compliment = !(f & Flags::CARRY_FLAG);
-  m_registers[Registers::AF].set_flag(Flags::CARRY_FLAG, compliment);
-  m_registers[Registers::AF].set_flag(Flags::HALF_CARRY_FLAG, false);
-  m_registers[Registers::AF].set_flag(Flags::SUBTRACT_FLAG, false);
+  bool compliment = !get_carry();
+  set_flag(Flags::CARRY_FLAG, compliment);
+  set_flag(Flags::HALF_CARRY_FLAG, false);
+  set_flag(Flags::SUBTRACT_FLAG, false);
 }
 
 void CPU::op_stop(uint8_t opcode) {}
 
+// Opcode: 0x76
+// Sleeps until an enabled interrupt is requested, see `run_until`.
+void CPU::op_halt(uint8_t opcode) {
+  // `ei; halt`: IME comes on as HALT runs, so an interrupt that is already
+  // pending wakes it straight away and returns to the instruction after it.
+  if (m_registers.interrupt_enable_pending) {
+    m_registers.interrupt_enable = 1;
+    m_registers.interrupt_enable_pending = false;
+  }
+  m_registers.halted = true;
+  shorten_batch(0);
+}
+
+// Opcode: 0xCB
+// Runs the next opcode from the CB table.
+void CPU::op_prefix_cb(uint8_t opcode) {
+  uint8_t cb_opcode = read_d8();
+  (this->*cb_opcode_table[cb_opcode])(cb_opcode);
+  m_extra_cycles = CB_OPCODE_CYCLES[cb_opcode];
+}
+
+// Opcode: 0xCB 0x00 - 0xCB 0x3F
+// Flags: z00c
+// rlc, rrc, rl, rr, sla, sra, swap, srl r
+template <uint8_t opcode> void CPU::op_rotate_r(uint8_t) {
+  constexpr Operand r = get_operand(opcode);
+  constexpr uint8_t operation = (opcode >> 3) & 0x07;
+
+  uint8_t value = read_operand<r>();
+  uint8_t carry_in = get_carry() ? 1 : 0;
+
+  uint8_t result;
+  bool carry;
+  if constexpr (operation == 0) {
+    result = (value << 1) | (value >> 7);
+    carry = value & 0x80;
+  } else if constexpr (operation == 1) {
+    result = (value >> 1) | (value << 7);
+    carry = value & 0x01;
+  } else if constexpr (operation == 2) {
+    result = (value << 1) | carry_in;
+    carry = value & 0x80;
+  } else if constexpr (operation == 3) {
+    result = (value >> 1) | (carry_in << 7);
+    carry = value & 0x01;
+  } else if constexpr (operation == 4) {
+    result = value << 1;
+    carry = value & 0x80;
+  } else if constexpr (operation == 5) {
+    result = (value >> 1) | (value & 0x80);
+    carry = value & 0x01;
+  } else if constexpr (operation == 6) {
+    result = (value << 4) | (value >> 4);
+    carry = false;
+  } else {
+    result = value >> 1;
+    carry = value & 0x01;
+  }
+
+  write_operand<r>(result);
+
+  uint8_t f = 0;
+  if (result == 0)
+    f |= Flags::ZERO_FLAG;
+  if (carry)
+    f |= Flags::CARRY_FLAG;
+  set_flags(f);
+}
+
+// Opcode: 0xCB 0x40 - 0xCB 0x7F
+// Flags: z01-
+// test bit n
+template <uint8_t opcode> void CPU::op_bit_n_r(uint8_t) {
+  constexpr uint8_t mask = 1 << ((opcode >> 3) & 0x07);
+  uint8_t value = read_operand<get_operand(opcode)>();
+
+  set_flag(Flags::ZERO_FLAG, !(value & mask));
+  set_flag(Flags::SUBTRACT_FLAG, false);
+  set_flag(Flags::HALF_CARRY_FLAG, true);
+}
+
+// Opcode: 0xCB 0x80 - 0xCB 0xBF
+// Flags: ----
+// reset bit n
+template <uint8_t opcode> void CPU::op_res_n_r(uint8_t) {
+  constexpr Operand r = get_operand(opcode);
+  constexpr uint8_t mask = 1 << ((opcode >> 3) & 0x07);
+  write_operand<r>(read_operand<r>() & ~mask);
+}
+
+// Opcode: 0xCB 0xC0 - 0xCB 0xFF
+// Flags: ----
+// set bit n
+template <uint8_t opcode> void CPU::op_set_n_r(uint8_t) {
+  constexpr Operand r = get_operand(opcode);
+  constexpr uint8_t mask = 1 << ((opcode >> 3) & 0x07);
+  write_operand<r>(read_operand<r>() | mask);
+}
+
+// Opcode: 0xF3
+// disable interrupts, IME=0
+void CPU::op_di(uint8_t opcode) {
+  m_registers.interrupt_enable = 0;
+  m_registers.interrupt_enable_pending = false;
+}
+
+// Opcode: 0xFB
+// enable interrupts, IME=1 after the next instruction
+// The batch ends here, see `enable_interrupts_delayed`.
+void CPU::op_ei(uint8_t opcode) {
+  m_registers.interrupt_enable_pending = true;
+  shorten_batch(0);
+}
+
 } // namespace gb
@@ -1,58 +1,78 @@
 #include "gameboy.h"
 
-namespace gb {
-
-Gameboy::Gameboy(const char *path)
-    : m_rom_path(path), m_rom_data(utility::get_rom_data(m_rom_path)),
-      m_cartridge(m_rom_data), m_cpu(*this), m_mem(*this), m_ppu(*this) {
-
-  SDL_Init(SDL_INIT_VIDEO);
+#include <thread>
 
-  m_window.reset(SDL_CreateWindow("gamerboy", SDL_WINDOWPOS_UNDEFINED,
-                                  SDL_WINDOWPOS_UNDEFINED, 320, 288,
-                                  SDL_WINDOW_OPENGL));
-
-  if (m_window == nullptr)
-    utility::error("Unable to create window", 1);
+namespace gb {
 
-  m_renderer.reset(
-      SDL_CreateRenderer(m_window.get(), -1,
-                         SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC));
+Gameboy::Gameboy(const char *path, FrameMailbox &frames, BootOptions boot)
+    : m_rom_path(path), m_rom_file(m_rom_path),
+      m_cartridge(m_rom_file.data()), m_frames(frames), m_cpu(*this),
+      m_mem(*this), m_ppu(*this), m_timer(*this) {
+  if (boot.check_header && !m_cartridge.get_info().is_header_valid())
+    utility::error("ROM header doesn't pass the boot ROM's check", 1);
 
-  m_texture.reset(SDL_CreateTexture(m_renderer.get(), SDL_PIXELFORMAT_ARGB8888,
-                                    SDL_TEXTUREACCESS_STREAMING, 320, 288));
+  if (boot.skip) {
+    m_cpu.skip_boot(BOOT_END_CYCLE);
+    m_mem.skip_boot();
+    m_ppu.skip_boot(BOOT_END_CYCLE);
+  }
+  m_scheduler.schedule(Event::FRAME_END, get_cycles() + FRAME_CYCLES / 4);
 }
 
-Gameboy::~Gameboy() {
-  // TODO: Not sure why I have to manually use the destroy functions now,
-  // something happened with `std::unique_ptr`?
-  SDL_DestroyTexture(m_texture.get());
-  SDL_DestroyRenderer(m_renderer.get());
-  SDL_DestroyWindow(m_window.get());
-  SDL_Quit();
+// When it falls behind it carries on from now, instead of rushing through
+// the frames it missed.
+void Gameboy::emulate(std::stop_token stop) {
+  auto deadline = std::chrono::steady_clock::now();
+  while (!stop.stop_requested()) {
+    run();
+    m_ppu.finish_frame();
+
+    deadline += FRAME_DURATION;
+    auto now = std::chrono::steady_clock::now();
+    if (deadline < now)
+      deadline = now;
+    else
+      std::this_thread::sleep_until(deadline);
+  }
 }
 
-void Gameboy::on() {
-  while (!did_quit()) {
-    process();
-    run();
+// Runs a frame, up to VBlank or with the LCD off a frame's worth of cycles.
+void Gameboy::run() {
+  // The CPU runs in batches up to the next scheduled event. Subsystems get
+  // called when one is due, or catch up when the CPU accesses them.
+  m_frame_done = false;
+  while (!m_frame_done) {
+    m_cpu.run_until(m_scheduler.next_cycle());
+    while (auto event = m_scheduler.pop_due(m_cpu.get_cycles()))
+      handle(*event);
   }
 }
 
-void Gameboy::process() {
-  SDL_Event e;
-  while (SDL_PollEvent(&e)) {
-    switch (e.type) {
-    case SDL_QUIT:
-      m_did_close = true;
-      break;
-    }
+// Handlers are given the cycle the event was due, not when the CPU stopped,
+// so following events don't drift.
+void Gameboy::handle(const ScheduledEvent &event) {
+  switch (event.event) {
+  case Event::VBLANK:
+    m_ppu.vblank(event.cycle);
+    m_frame_done = true;
+    break;
+  case Event::TIMER_OVERFLOW:
+    m_timer.overflow(event.cycle);
+    break;
+  case Event::OAM_DMA_END:
+    m_mem.end_oam_dma();
+    break;
+  // Only paces frames while the LCD is off, otherwise they end at VBlank.
+  case Event::FRAME_END:
+    m_frame_done |= !m_ppu.is_enabled();
+    m_scheduler.schedule(Event::FRAME_END, event.cycle + FRAME_CYCLES / 4);
+    break;
   }
 }
 
-void Gameboy::run() {
-  m_cycles += m_cpu.cycle();
-  m_ppu.cycle(m_cycles);
+void Gameboy::schedule(Event event, uint64_t cycle) {
+  m_scheduler.schedule(event, cycle);
+  m_cpu.shorten_batch(cycle);
 }
 
 } // namespace gb
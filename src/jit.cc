@@ -0,0 +1,575 @@
+#include "jit.h"
+
+#include "cpu.h"
+#include "utility.h"
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <sys/mman.h>
+
+namespace gb {
+
+X64Emitter::X64Emitter(std::size_t size) : m_size(size) {
+  void *code = mmap(nullptr, size, PROT_READ | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED)
+    utility::error("Unable to map the recompiler code buffer", 5);
+  m_code = static_cast<uint8_t *>(code);
+}
+
+X64Emitter::~X64Emitter() { munmap(m_code, m_size); }
+
+// The buffer is never writable and executable at the same time.
+uint8_t *X64Emitter::begin() {
+  mprotect(m_code, m_size, PROT_READ | PROT_WRITE);
+  m_function = m_used;
+  return m_code + m_function;
+}
+
+void X64Emitter::end() {
+  mprotect(m_code, m_size, PROT_READ | PROT_EXEC);
+  __builtin___clear_cache(reinterpret_cast<char *>(m_code + m_function),
+                          reinterpret_cast<char *>(m_code + m_used));
+}
+
+void X64Emitter::emit32(uint32_t value) {
+  std::memcpy(m_code + m_used, &value, sizeof(value));
+  m_used += sizeof(value);
+}
+
+void X64Emitter::emit64(uint64_t value) {
+  std::memcpy(m_code + m_used, &value, sizeof(value));
+  m_used += sizeof(value);
+}
+
+// spl, bpl, sil and dil can only be addressed with a REX prefix, without one
+// they encode ah, ch, dh and bh.
+void X64Emitter::rex(bool wide, uint8_t reg, uint8_t rm, bool byte_operands) {
+  uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  bool legacy_high = byte_operands && ((reg >= 4 && reg < 8) ||
+                                       (rm >= 4 && rm < 8));
+  if (prefix != 0x40 || legacy_high)
+    emit(prefix);
+}
+
+void X64Emitter::modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+  emit((mod << 6) | ((reg & 0x07) << 3) | (rm & 0x07));
+}
+
+#define GB_REG(r) static_cast<uint8_t>(r)
+
+void X64Emitter::mov(X64 dst, X64 src) {
+  rex(false, GB_REG(src), GB_REG(dst));
+  emit(0x89);
+  modrm(3, GB_REG(src), GB_REG(dst));
+}
+
+void X64Emitter::mov(X64 dst, uint32_t imm) {
+  rex(false, 0, GB_REG(dst));
+  emit(0xB8 | (GB_REG(dst) & 0x07));
+  emit32(imm);
+}
+
+void X64Emitter::mov64(X64 dst, X64 src) {
+  rex(true, GB_REG(src), GB_REG(dst));
+  emit(0x89);
+  modrm(3, GB_REG(src), GB_REG(dst));
+}
+
+void X64Emitter::mov64(X64 dst, uint64_t imm) {
+  rex(true, 0, GB_REG(dst));
+  emit(0xB8 | (GB_REG(dst) & 0x07));
+  emit64(imm);
+}
+
+void X64Emitter::movzx8(X64 dst, X64 src) {
+  rex(false, GB_REG(dst), GB_REG(src), true);
+  emit(0x0F);
+  emit(0xB6);
+  modrm(3, GB_REG(dst), GB_REG(src));
+}
+
+void X64Emitter::movzx16(X64 dst, X64 src) {
+  rex(false, GB_REG(dst), GB_REG(src));
+  emit(0x0F);
+  emit(0xB7);
+  modrm(3, GB_REG(dst), GB_REG(src));
+}
+
+// rsp and r12 as a base need a SIB byte, they are never used here.
+void X64Emitter::load16(X64 dst, X64 base, int8_t disp) {
+  rex(false, GB_REG(dst), GB_REG(base));
+  emit(0x0F);
+  emit(0xB7);
+  modrm(1, GB_REG(dst), GB_REG(base));
+  emit(disp);
+}
+
+void X64Emitter::store16(X64 base, int8_t disp, X64 src) {
+  emit(0x66);
+  rex(false, GB_REG(src), GB_REG(base));
+  emit(0x89);
+  modrm(1, GB_REG(src), GB_REG(base));
+  emit(disp);
+}
+
+void X64Emitter::alu(X64Alu op, X64 dst, X64 src) {
+  rex(false, GB_REG(src), GB_REG(dst));
+  emit((GB_REG(op) << 3) | 0x01);
+  modrm(3, GB_REG(src), GB_REG(dst));
+}
+
+void X64Emitter::alu(X64Alu op, X64 dst, uint32_t imm) {
+  rex(false, 0, GB_REG(dst));
+  emit(0x81);
+  modrm(3, GB_REG(op), GB_REG(dst));
+  emit32(imm);
+}
+
+void X64Emitter::alu8(X64Alu op, X64 dst, X64 src) {
+  rex(false, GB_REG(src), GB_REG(dst), true);
+  emit(GB_REG(op) << 3);
+  modrm(3, GB_REG(src), GB_REG(dst));
+}
+
+void X64Emitter::test8(X64 reg, uint8_t imm) {
+  rex(false, 0, GB_REG(reg), true);
+  emit(0xF6);
+  modrm(3, 0, GB_REG(reg));
+  emit(imm);
+}
+
+void X64Emitter::bt(X64 reg, uint8_t bit) {
+  rex(false, 0, GB_REG(reg));
+  emit(0x0F);
+  emit(0xBA);
+  modrm(3, 4, GB_REG(reg));
+  emit(bit);
+}
+
+void X64Emitter::setcc(X64Condition condition, X64 dst) {
+  rex(false, 0, GB_REG(dst), true);
+  emit(0x0F);
+  emit(0x90 | GB_REG(condition));
+  modrm(3, 0, GB_REG(dst));
+}
+
+void X64Emitter::shl(X64 reg, uint8_t count) {
+  rex(false, 0, GB_REG(reg));
+  emit(0xC1);
+  modrm(3, 4, GB_REG(reg));
+  emit(count);
+}
+
+void X64Emitter::shr(X64 reg, uint8_t count) {
+  rex(false, 0, GB_REG(reg));
+  emit(0xC1);
+  modrm(3, 5, GB_REG(reg));
+  emit(count);
+}
+
+// [rsp] is encoded as mod 0, rm 4 and a SIB byte of 0x24.
+void X64Emitter::store_local(uint32_t imm) {
+  emit(0xC7);
+  modrm(0, 0, 4);
+  emit(0x24);
+  emit32(imm);
+}
+
+void X64Emitter::load_local(X64 dst) {
+  rex(false, GB_REG(dst), 0);
+  emit(0x8B);
+  modrm(0, GB_REG(dst), 4);
+  emit(0x24);
+}
+
+void X64Emitter::add_local(uint32_t imm) {
+  emit(0x81);
+  modrm(0, 0, 4);
+  emit(0x24);
+  emit32(imm);
+}
+
+void X64Emitter::add_local(X64 src) {
+  rex(false, GB_REG(src), 0);
+  emit(0x01);
+  modrm(0, GB_REG(src), 4);
+  emit(0x24);
+}
+
+void X64Emitter::push(X64 reg) {
+  rex(false, 0, GB_REG(reg));
+  emit(0x50 | (GB_REG(reg) & 0x07));
+}
+
+void X64Emitter::pop(X64 reg) {
+  rex(false, 0, GB_REG(reg));
+  emit(0x58 | (GB_REG(reg) & 0x07));
+}
+
+void X64Emitter::add_rsp(uint8_t imm) {
+  emit(0x48);
+  emit(0x83);
+  modrm(3, 0, 4);
+  emit(imm);
+}
+
+void X64Emitter::sub_rsp(uint8_t imm) {
+  emit(0x48);
+  emit(0x83);
+  modrm(3, 5, 4);
+  emit(imm);
+}
+
+void X64Emitter::call(X64 reg) {
+  rex(false, 0, GB_REG(reg));
+  emit(0xFF);
+  modrm(3, 2, GB_REG(reg));
+}
+
+void X64Emitter::ret() { emit(0xC3); }
+
+uint8_t *X64Emitter::jcc(X64Condition condition) {
+  emit(0x0F);
+  emit(0x80 | GB_REG(condition));
+  uint8_t *displacement = m_code + m_used;
+  emit32(0);
+  return displacement;
+}
+
+void X64Emitter::bind(uint8_t *displacement) {
+  int32_t offset = static_cast<int32_t>(m_code + m_used - (displacement + 4));
+  std::memcpy(displacement, &offset, sizeof(offset));
+}
+
+#undef GB_REG
+
+// Guest register pairs live in callee saved host registers for the whole
+// block, the high byte in bits 8-15 and the low byte in bits 0-7. rbx holds
+// the `CPU`, rbp the register file and [rsp] the elapsed cycles.
+constexpr X64 CPU_REGISTER = X64::RBX;
+constexpr X64 FILE_REGISTER = X64::RBP;
+constexpr std::array<X64, 4> PAIR_REGISTERS = {X64::R12, X64::R13, X64::R14,
+                                               X64::R15};
+
+static_assert(sizeof(DoubleRegister) == 2 &&
+                  std::is_standard_layout_v<DoubleRegister> &&
+                  offsetof(RegisterFile, pairs) == 0,
+              "Register pairs are loaded straight from the register file");
+
+// Worst case bytes emitted for one instruction, an interpreter call.
+constexpr std::size_t MAX_INSTRUCTION_BYTES = 160;
+constexpr std::size_t MAX_PROLOGUE_BYTES = 128;
+
+// Where an 8-bit operand lives: its pair and whether it is the high byte.
+constexpr std::pair<X64, bool> operand_location(Operand r) {
+  switch (r) {
+  case Operand::B:
+    return {X64::R13, true};
+  case Operand::C:
+    return {X64::R13, false};
+  case Operand::D:
+    return {X64::R14, true};
+  case Operand::E:
+    return {X64::R14, false};
+  case Operand::H:
+    return {X64::R15, true};
+  case Operand::L:
+    return {X64::R15, false};
+  default:
+    return {X64::R12, true};
+  }
+}
+
+// dst = r, zero extended.
+static void load_operand(X64Emitter &e, Operand r, X64 dst) {
+  auto [pair, high] = operand_location(r);
+  if (high) {
+    e.mov(dst, pair);
+    e.shr(dst, 8);
+  } else {
+    e.movzx8(dst, pair);
+  }
+}
+
+// r = src, which has to be zero extended and is clobbered.
+static void store_operand(X64Emitter &e, Operand r, X64 src) {
+  auto [pair, high] = operand_location(r);
+  if (high) {
+    e.alu(X64Alu::AND, pair, 0x00FFu);
+    e.shl(src, 8);
+  } else {
+    e.alu(X64Alu::AND, pair, 0xFF00u);
+  }
+  e.alu(X64Alu::OR, pair, src);
+}
+
+// Each pair in the register file is a native 16-bit word, a plain word load
+// puts the high byte in bits 8-15 and the low byte in bits 0-7.
+static void load_pairs(X64Emitter &e) {
+  for (std::size_t i = 0; i < PAIR_REGISTERS.size(); i++)
+    e.load16(PAIR_REGISTERS[i], FILE_REGISTER, i * 2);
+}
+
+static void store_pairs(X64Emitter &e) {
+  for (std::size_t i = 0; i < PAIR_REGISTERS.size(); i++)
+    e.store16(FILE_REGISTER, i * 2, PAIR_REGISTERS[i]);
+}
+
+// Sets the zero flag in edx from al, clobbers r9.
+static void zero_flag(X64Emitter &e) {
+  e.test8(X64::RAX, 0xFF);
+  e.setcc(X64Condition::ZERO, X64::R9);
+  e.movzx8(X64::R9, X64::R9);
+  e.shl(X64::R9, 7);
+  e.alu(X64Alu::OR, X64::RDX, X64::R9);
+}
+
+// Sets the half carry flag in edx, which holds `a ^ b`, from the result in
+// eax. Bit 4 of `a ^ b ^ result` is the carry (or borrow) into bit 4.
+static void half_carry_flag(X64Emitter &e) {
+  e.alu(X64Alu::XOR, X64::RDX, X64::RAX);
+  e.alu(X64Alu::AND, X64::RDX, 0x10u);
+  e.shl(X64::RDX, 1);
+}
+
+// A = A <operation> ecx, the operation being bits 3-5 of the opcode.
+static void emit_alu(X64Emitter &e, uint8_t operation) {
+  load_operand(e, Operand::A, X64::RAX);
+  e.mov(X64::RDX, X64::RAX);
+  e.alu(X64Alu::XOR, X64::RDX, X64::RCX);
+
+  constexpr std::array<X64Alu, 8> host = {X64Alu::ADD, X64Alu::ADC,
+                                          X64Alu::SUB, X64Alu::SBB,
+                                          X64Alu::AND, X64Alu::XOR,
+                                          X64Alu::OR,  X64Alu::SUB};
+  if (host[operation] == X64Alu::ADC || host[operation] == X64Alu::SBB)
+    e.bt(X64::R12, 4);
+  e.alu8(host[operation], X64::RAX, X64::RCX);
+
+  switch (operation) {
+  case 4:
+    e.mov(X64::RDX, static_cast<uint32_t>(HALF_CARRY_FLAG));
+    break;
+  case 5:
+  case 6:
+    e.mov(X64::RDX, 0u);
+    break;
+  default:
+    e.setcc(X64Condition::CARRY, X64::R8);
+    e.movzx8(X64::R8, X64::R8);
+    e.shl(X64::R8, 4);
+    half_carry_flag(e);
+    e.alu(X64Alu::OR, X64::RDX, X64::R8);
+    break;
+  }
+
+  zero_flag(e);
+  if (operation == 2 || operation == 3 || operation == 7)
+    e.alu(X64Alu::OR, X64::RDX, static_cast<uint32_t>(SUBTRACT_FLAG));
+
+  if (operation == 7) {
+    e.alu(X64Alu::AND, X64::R12, 0xFF00u);
+    e.alu(X64Alu::OR, X64::R12, X64::RDX);
+  } else {
+    e.shl(X64::RAX, 8);
+    e.alu(X64Alu::OR, X64::RAX, X64::RDX);
+    e.mov(X64::R12, X64::RAX);
+  }
+}
+
+// inc r / dec r, the carry flag is left alone.
+static void emit_inc_dec(X64Emitter &e, Operand r, bool dec) {
+  load_operand(e, r, X64::RAX);
+  e.mov(X64::RCX, 1u);
+  e.mov(X64::RDX, X64::RAX);
+  e.alu(X64Alu::XOR, X64::RDX, X64::RCX);
+  e.alu8(dec ? X64Alu::SUB : X64Alu::ADD, X64::RAX, X64::RCX);
+
+  half_carry_flag(e);
+  zero_flag(e);
+  if (dec)
+    e.alu(X64Alu::OR, X64::RDX, static_cast<uint32_t>(SUBTRACT_FLAG));
+  e.mov(X64::R8, X64::R12);
+  e.alu(X64Alu::AND, X64::R8, static_cast<uint32_t>(CARRY_FLAG));
+  e.alu(X64Alu::OR, X64::RDX, X64::R8);
+
+  e.alu(X64Alu::AND, X64::R12, 0xFF00u);
+  e.alu(X64Alu::OR, X64::R12, X64::RDX);
+  store_operand(e, r, X64::RAX);
+}
+
+// Emits native code for the instructions that only touch registers, returns
+// false for the rest so they go through the interpreter.
+static bool emit_native(X64Emitter &e, uint8_t opcode, uint16_t immediate) {
+  if (opcode == 0x00)
+    return true;
+
+  // ld r,r
+  if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76) {
+    Operand dst = static_cast<Operand>((opcode >> 3) & 0x07);
+    Operand src = static_cast<Operand>(opcode & 0x07);
+    if (dst == Operand::DHL || src == Operand::DHL)
+      return false;
+    if (dst != src) {
+      load_operand(e, src, X64::RAX);
+      store_operand(e, dst, X64::RAX);
+    }
+    return true;
+  }
+
+  // alu a,r
+  if (opcode >= 0x80 && opcode < 0xC0) {
+    Operand src = static_cast<Operand>(opcode & 0x07);
+    if (src == Operand::DHL)
+      return false;
+    load_operand(e, src, X64::RCX);
+    emit_alu(e, (opcode >> 3) & 0x07);
+    return true;
+  }
+
+  // alu a,d8
+  if (opcode >= 0xC0 && (opcode & 0x07) == 0x06) {
+    e.mov(X64::RCX, static_cast<uint32_t>(immediate & 0xFF));
+    emit_alu(e, (opcode >> 3) & 0x07);
+    return true;
+  }
+
+  if (opcode >= 0x40)
+    return false;
+
+  // rr is BC, DE or HL, SP stays in the register file.
+  Operand r = static_cast<Operand>((opcode >> 3) & 0x07);
+  bool sp = (opcode >> 4) == 0x03;
+  X64 rr = PAIR_REGISTERS[sp ? 0 : (opcode >> 4) + 1];
+  switch (opcode & 0x0F) {
+  // ld rr,d16
+  case 0x01:
+    if (sp)
+      return false;
+    e.mov(rr, static_cast<uint32_t>(immediate));
+    return true;
+  // inc rr / dec rr
+  case 0x03:
+  case 0x0B:
+    if (sp)
+      return false;
+    e.alu((opcode & 0x08) ? X64Alu::SUB : X64Alu::ADD, rr, 1u);
+    e.movzx16(rr, rr);
+    return true;
+  // inc r / dec r
+  case 0x04:
+  case 0x05:
+  case 0x0C:
+  case 0x0D:
+    if (r == Operand::DHL)
+      return false;
+    emit_inc_dec(e, r, opcode & 0x01);
+    return true;
+  // ld r,d8
+  case 0x06:
+  case 0x0E:
+    if (r == Operand::DHL)
+      return false;
+    e.mov(X64::RAX, static_cast<uint32_t>(immediate & 0xFF));
+    store_operand(e, r, X64::RAX);
+    return true;
+  default:
+    return false;
+  }
+}
+
+native_block_t CPU::compile_block(Block &block, uint16_t address) {
+  std::size_t worst_case =
+      MAX_PROLOGUE_BYTES + block.instructions.size() * MAX_INSTRUCTION_BYTES;
+  if (!m_jit.has_room(worst_case))
+    return nullptr;
+
+  X64Emitter &e = m_jit;
+  uint8_t *code = e.begin();
+
+  // Six pushes and the local keep rsp 16 byte aligned for the calls below.
+  e.push(X64::RBX);
+  e.push(X64::RBP);
+  e.push(X64::R12);
+  e.push(X64::R13);
+  e.push(X64::R14);
+  e.push(X64::R15);
+  e.sub_rsp(8);
+  e.mov64(CPU_REGISTER, X64::RDI);
+  e.mov64(FILE_REGISTER, X64::RSI);
+  e.store_local(0);
+  load_pairs(e);
+
+  std::vector<uint8_t *> exits;
+  uint16_t pc = address;
+  block.native_tail = false;
+  for (const DecodedInstruction &instruction : block.instructions) {
+    pc += instruction.length;
+    e.add_local(instruction.cycles);
+
+    if (!instruction.prefixed &&
+        emit_native(e, instruction.opcode, instruction.immediate)) {
+      block.native_tail = true;
+      continue;
+    }
+
+    // Everything else runs the interpreter handler, with the guest registers
+    // written back around the call.
+    block.native_tail = false;
+    store_pairs(e);
+    e.mov64(X64::RDI, CPU_REGISTER);
+    e.mov64(X64::RSI, reinterpret_cast<uint64_t>(&instruction));
+    e.mov(X64::RDX, static_cast<uint32_t>(pc));
+    e.load_local(X64::RCX);
+    e.mov64(X64::RAX, reinterpret_cast<uint64_t>(&CPU::jit_interpret));
+    e.call(X64::RAX);
+    load_pairs(e);
+    e.alu(X64Alu::OR, X64::RAX, X64::RAX);
+    exits.push_back(e.jcc(X64Condition::SIGN));
+    e.add_local(X64::RAX);
+  }
+
+  for (uint8_t *exit : exits)
+    e.bind(exit);
+  store_pairs(e);
+  e.load_local(X64::RAX);
+  e.add_rsp(8);
+  e.pop(X64::R15);
+  e.pop(X64::R14);
+  e.pop(X64::R13);
+  e.pop(X64::R12);
+  e.pop(X64::RBP);
+  e.pop(X64::RBX);
+  e.ret();
+  e.end();
+
+  return reinterpret_cast<native_block_t>(code);
+}
+
+// Called from native code, runs one instruction on the interpreter. Returns
+// the extra cycles it took, or -1 when the block has to be left.
+// `block_cycles` is what the block has counted so far, including this
+// instruction.
+int32_t CPU::jit_interpret(CPU *cpu, const DecodedInstruction *instruction,
+                           uint16_t next_pc, int32_t block_cycles) {
+  uint64_t block_start = cpu->m_batch_elapsed;
+  cpu->m_batch_elapsed += block_cycles - instruction->cycles;
+  cpu->m_registers.pc = next_pc;
+  cpu->m_immediate = instruction->immediate;
+  (cpu->*instruction->handler)(instruction->opcode);
+  cpu->get_flags();
+  cpu->m_batch_elapsed = block_start;
+  if (cpu->m_exit_block)
+    return -1;
+  return cpu->take_extra_cycles();
+}
+
+void CPU::flush_native_blocks() {
+  for (auto &[key, block] : m_blocks)
+    block.native = nullptr;
+  m_jit.reset();
+}
+
+} // namespace gb
@@ -0,0 +1,141 @@
+#include "line_renderer.h"
+
+#include <algorithm>
+
+namespace gb {
+
+constexpr std::size_t SPRITE_COUNT = 40;
+constexpr std::size_t LINE_SPRITE_COUNT = 10;
+
+// Tile a background or window map entry refers to. With LCDC bit 4 off
+// they're signed, from the tiles at 0x9000.
+static uint16_t get_map_tile(uint8_t control, uint8_t index) {
+  return control & 0x10 ? index : 0x100 + static_cast<int8_t>(index);
+}
+
+void TileCache::decode(uint16_t tile) {
+  const uint8_t *data = m_vram + tile * 16;
+  for (uint8_t row = 0; row < 8; row++) {
+    uint8_t low = data[row * 2];
+    uint8_t high = data[row * 2 + 1];
+    for (uint8_t x = 0; x < 8; x++) {
+      uint8_t color = (low >> (7 - x) & 0x01) | (high >> (7 - x) & 0x01) << 1;
+      m_tiles[tile][row * 8 + x] = color;
+      m_flipped[tile][row * 8 + 7 - x] = color;
+    }
+  }
+  m_dirty[tile] = false;
+}
+
+void LineRenderer::draw_line(uint8_t line) {
+  uint8_t control = get_io(LCD_CONTROL);
+  Palettes palettes{get_io(BACKGROUND_PALETTE),
+                    get_io(OBJECT_PALETTE_0),
+                    get_io(OBJECT_PALETTE_1)};
+
+  // With LCDC bit 0 off there's no background or window, all of it is color
+  // 0 and white.
+  std::array<uint8_t, SCREEN_WIDTH> background{};
+  if (control & 0x01) {
+    draw_background(line, background.data());
+    draw_window(line, background.data());
+  } else {
+    palettes.background = 0x00;
+  }
+
+  std::array<uint8_t, SCREEN_WIDTH> sprites{};
+  std::array<uint8_t, SCREEN_WIDTH> sprite_flags{};
+  if (control & 0x02)
+    draw_sprites(line, sprites.data(), sprite_flags.data());
+
+  m_composite({background.data(), sprites.data(), sprite_flags.data()},
+              SCREEN_WIDTH, palettes, m_target + line * m_pitch);
+}
+
+void LineRenderer::clear() {
+  for (uint8_t line = 0; line < SCREEN_HEIGHT; line++)
+    std::fill_n(m_target + line * m_pitch, SCREEN_WIDTH, SHADES[0]);
+}
+
+void LineRenderer::draw_background(uint8_t line, uint8_t *colors) {
+  uint8_t control = get_io(LCD_CONTROL);
+  uint8_t scroll_x = get_io(SCROLL_X);
+  uint8_t y = line + get_io(SCROLL_Y);
+  const uint8_t *map =
+      m_memory.vram + (control & 0x08 ? 0x1C00 : 0x1800) + y / 8 * 32;
+
+  // Whole tiles from the one the line starts in, then the part of them that
+  // is on screen.
+  std::array<uint8_t, SCREEN_WIDTH + 8> row;
+  for (uint8_t i = 0; i <= SCREEN_WIDTH / 8; i++) {
+    uint8_t index = map[(scroll_x / 8 + i) % 32];
+    std::copy_n(m_tiles.get_row(get_map_tile(control, index), y % 8, false), 8,
+                row.begin() + i * 8);
+  }
+  std::copy_n(row.begin() + scroll_x % 8, SCREEN_WIDTH, colors);
+}
+
+// The window covers the background from WX - 7 to the right edge.
+void LineRenderer::draw_window(uint8_t line, uint8_t *colors) {
+  uint8_t control = get_io(LCD_CONTROL);
+  int left = get_io(WINDOW_X) - 7;
+  if (!(control & 0x20) || line < get_io(WINDOW_Y) ||
+      left >= SCREEN_WIDTH)
+    return;
+
+  const uint8_t *map = m_memory.vram + (control & 0x40 ? 0x1C00 : 0x1800) +
+                       m_window_line / 8 * 32;
+  for (int i = 0, x = left; x < SCREEN_WIDTH; i++, x += 8) {
+    const uint8_t *row = m_tiles.get_row(get_map_tile(control, map[i]),
+                                         m_window_line % 8, false);
+    for (int pixel = std::max(-x, 0); pixel < 8 && x + pixel < SCREEN_WIDTH;
+         pixel++)
+      colors[x + pixel] = row[pixel];
+  }
+  m_window_line++;
+}
+
+// Up to 10 sprites a line, the first ones in OAM. Where they overlap the one
+// with the smaller X wins, then the one first in OAM, even when it ends up
+// hidden behind the background.
+void LineRenderer::draw_sprites(uint8_t line, uint8_t *colors, uint8_t *flags) {
+  uint8_t control = get_io(LCD_CONTROL);
+  uint8_t height = control & 0x04 ? 16 : 8;
+  const uint8_t *oam = m_memory.oam;
+
+  std::array<const uint8_t *, LINE_SPRITE_COUNT> sprites;
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < SPRITE_COUNT && count < sprites.size(); i++) {
+    const uint8_t *sprite = oam + i * 4;
+    int top = sprite[0] - 16;
+    if (line >= top && line < top + height)
+      sprites[count++] = sprite;
+  }
+  std::stable_sort(
+      sprites.begin(), sprites.begin() + count,
+      [](const uint8_t *a, const uint8_t *b) { return a[1] < b[1]; });
+
+  for (std::size_t i = 0; i < count; i++) {
+    const uint8_t *sprite = sprites[i];
+    uint8_t attributes = sprite[3];
+    uint8_t row = line - (sprite[0] - 16);
+    if (attributes & 0x40)
+      row = height - 1 - row;
+    // 8x16 sprites are two tiles, the bottom bit of the number is ignored.
+    uint16_t tile = height == 16 ? (sprite[2] & 0xFE) + row / 8 : sprite[2];
+    const uint8_t *pixels = m_tiles.get_row(tile, row % 8, attributes & 0x20);
+    uint8_t sprite_flags = (attributes & 0x10 ? SPRITE_PALETTE_1 : 0) |
+                           (attributes & 0x80 ? SPRITE_BEHIND : 0);
+
+    int left = sprite[1] - 8;
+    for (int pixel = 0; pixel < 8; pixel++) {
+      int x = left + pixel;
+      if (x < 0 || x >= SCREEN_WIDTH || pixels[pixel] == 0 || colors[x] != 0)
+        continue;
+      colors[x] = pixels[pixel];
+      flags[x] = sprite_flags;
+    }
+  }
+}
+
+} // namespace gb
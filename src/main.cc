@@ -1,16 +1,31 @@
 #include "gameboy.h"
+#include "screen.h"
 #include "utility.h"
 
 #include <filesystem>
 #include <iostream>
+#include <string_view>
 
 int main(int argc, char **argv) {
 
-  if (argc < 2)
+  gb::BootOptions boot;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg == "--skip-boot")
+      boot.skip = true;
+    else if (arg == "--check-header")
+      boot.check_header = true;
+    else
+      path = argv[i];
+  }
+
+  if (path == nullptr)
     gb::utility::error("Please pass in the path to the ROM", 1);
 
-  gb::Gameboy gb(argv[1]);
-  gb.on();
+  gb::Screen screen;
+  gb::Gameboy gb(path, screen.get_frames(), boot);
+  screen.show(gb);
 
   return 0;
 }
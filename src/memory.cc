@@ -2,54 +2,311 @@
 
 #include "gameboy.h"
 
+#include <algorithm>
+
 namespace gb {
+
+// The ® the boot ROM draws after the logo, one bit plane.
+constexpr std::array<uint8_t, 8> REGISTERED_TILE{0x3C, 0x42, 0xB9, 0xA5,
+                                                 0xB9, 0xA5, 0x42, 0x3C};
+
+template <uint8_t reg> void Memory::write_video(Memory &mem, uint8_t value) {
+  PPU &ppu = mem.m_gb.get_ppu();
+  ppu.catch_up();
+  mem.m_io[reg] = value;
+  ppu.write(0xFF00 | reg, value);
+}
+
+// Registers that aren't listed read 0xFF and ignore writes. Sound isn't
+// emulated, its registers only keep what's written.
+constinit const std::array<Memory::IoRegister, 0x100> Memory::IO_REGISTERS =
+    [] {
+      std::array<IoRegister, 0x100> io{};
+
+      io[JOYPAD] = {0xCF, 0x30};
+      io[SERIAL_DATA] = {0x00, 0xFF};
+      io[SERIAL_CONTROL] = {0x7E, 0x81};
+
+      io[DIVIDER] = {
+          0x00, 0x00,
+          [](Memory &mem) { return mem.m_gb.get_timer().read_divider(); },
+          [](Memory &mem, uint8_t value) {
+            mem.m_gb.get_timer().write_divider(value);
+          }};
+      io[TIMER_COUNTER] = {
+          0x00, 0xFF,
+          [](Memory &mem) { return mem.m_gb.get_timer().read_counter(); },
+          [](Memory &mem, uint8_t value) {
+            mem.m_gb.get_timer().write_counter(value);
+          }};
+      io[TIMER_MODULO] = {0x00, 0xFF, nullptr, [](Memory &mem, uint8_t value) {
+                            mem.m_gb.get_timer().write_modulo(value);
+                          }};
+      io[TIMER_CONTROL] = {0xF8, 0x07, nullptr,
+                           [](Memory &mem, uint8_t value) {
+                             mem.m_gb.get_timer().write_control(value);
+                           }};
+
+      io[INTERRUPT_FLAG] = {
+          0xE0, 0x1F,
+          [](Memory &mem) { return mem.m_gb.get_cpu().read_interrupt_flag(); },
+          [](Memory &mem, uint8_t value) {
+            mem.m_gb.get_cpu().write_interrupt_flag(value);
+          }};
+      io[INTERRUPT_ENABLE] = {
+          0xE0, 0x1F,
+          [](Memory &mem) {
+            return mem.m_gb.get_cpu().read_interrupt_enable();
+          },
+          [](Memory &mem, uint8_t value) {
+            mem.m_gb.get_cpu().write_interrupt_enable(value);
+          }};
+
+      // NR10-NR51, there is no 0xFF15 or 0xFF1F.
+      constexpr std::array<uint8_t, 0x16> sound_unused{
+          0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F,
+          0xFF, 0x9F, 0xFF, 0xBF, 0xFF, 0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00};
+      for (std::size_t i = 0; i < sound_unused.size(); i++)
+        if (i != 0x05 && i != 0x0F)
+          io[0x10 + i] = {sound_unused[i], 0xFF};
+      // Only the power bit is writable, the channel bits read as off.
+      io[SOUND_ON] = {0x70, 0x80};
+      // Wave RAM
+      for (std::size_t reg = 0x30; reg < 0x40; reg++)
+        io[reg] = {0x00, 0xFF};
+
+      io[LCD_CONTROL] = {0x00, 0xFF, nullptr, [](Memory &mem, uint8_t value) {
+                           mem.m_gb.get_ppu().write_lcd_control(value);
+                         }};
+      io[LCD_STATUS] = {
+          0x80, 0x78,
+          [](Memory &mem) { return mem.m_gb.get_ppu().read_lcd_status(); }};
+      io[LINE_Y] = {0x00, 0x00, [](Memory &mem) {
+                      return mem.m_gb.get_ppu().read_line_y();
+                    }};
+      io[OAM_DMA] = {0x00, 0xFF, nullptr, [](Memory &mem, uint8_t value) {
+                       mem.start_oam_dma(value);
+                     }};
+      io[LINE_Y_COMPARE] = {0x00, 0xFF};
+      io[SCROLL_Y] = {0x00, 0xFF, nullptr, &write_video<SCROLL_Y>};
+      io[SCROLL_X] = {0x00, 0xFF, nullptr, &write_video<SCROLL_X>};
+      io[BACKGROUND_PALETTE] = {0x00, 0xFF, nullptr,
+                                &write_video<BACKGROUND_PALETTE>};
+      io[OBJECT_PALETTE_0] = {0x00, 0xFF, nullptr,
+                              &write_video<OBJECT_PALETTE_0>};
+      io[OBJECT_PALETTE_1] = {0x00, 0xFF, nullptr,
+                              &write_video<OBJECT_PALETTE_1>};
+      io[WINDOW_Y] = {0x00, 0xFF, nullptr, &write_video<WINDOW_Y>};
+      io[WINDOW_X] = {0x00, 0xFF, nullptr, &write_video<WINDOW_X>};
+
+      io[BOOT_ROM_DISABLE] = {0xFF, 0xFF, nullptr, [](Memory &mem, uint8_t) {
+                                mem.m_boot_rom_disabled = true;
+                                mem.map_rom();
+                              }};
+
+      // HRAM
+      for (std::size_t reg = 0x80; reg < 0xFF; reg++)
+        io[reg] = {0x00, 0xFF};
+      return io;
+    }();
+
 Memory::Memory(Gameboy &gb) : m_gb(gb), m_cartridge(gb.get_cartridge()) {
-  m_boot_rom = utility::get_boot_rom_data();
+  for (std::size_t page = 0x00; page < 0x80; page++) {
+    m_read_handlers[page] = &Memory::read_open_bus;
+    m_write_handlers[page] = &Memory::write_mbc;
+  }
+  for (std::size_t page = 0xA0; page < 0xC0; page++) {
+    m_read_handlers[page] = &Memory::read_mbc_ram;
+    m_write_handlers[page] = &Memory::write_mbc_ram;
+  }
+  // VRAM is only read directly, writes can change what the PPU draws.
+  for (std::size_t page = 0x80; page < 0xA0; page++) {
+    m_read_pages[page] = &m_vram[(page - 0x80) << 8];
+    m_write_handlers[page] = &Memory::write_vram;
+  }
+  m_read_handlers[0xFE] = &Memory::read_oam;
+  m_write_handlers[0xFE] = &Memory::write_oam;
+
+  map_rom();
+  map_external_ram();
+  map_ram(0xC0, 0xDF, m_ram.data());
+  map_ram(0xE0, 0xFD, m_ram.data());
 }
 
-uint8_t Memory::read_memory(uint16_t addr) {
-  if (m_read_map.count(addr)) {
-    auto read_method = m_read_map.find(addr)->second;
-    return (this->*read_method)(addr);
+void Memory::map_ram(uint8_t first, uint8_t last, uint8_t *data) {
+  for (std::size_t page = first; page <= last; page++, data += 0x100) {
+    m_read_pages[page] = data;
+    m_write_pages[page] = data;
   }
+}
 
-  return 0;
+void Memory::map_rom() {
+  const uint8_t *rom = m_cartridge.get_rom_data();
+  std::size_t size = m_cartridge.get_rom_size();
+  std::size_t bank0 = m_cartridge.get_rom_bank0() * 0x4000;
+  std::size_t bank = m_cartridge.get_rom_bank() * 0x4000;
+
+  for (std::size_t page = 0x00; page < 0x80; page++) {
+    std::size_t offset = ((page & 0x3F) << 8) + (page < 0x40 ? bank0 : bank);
+    m_read_pages[page] = offset + 0x100 <= size ? rom + offset : nullptr;
+  }
+
+  if (!is_boot_rom_disabled())
+    m_read_pages[0x00] = DMG_BOOT_ROM.data();
+}
+
+void Memory::map_external_ram() {
+  uint8_t *ram = m_cartridge.get_ram_bank_data();
+  std::size_t size = m_cartridge.get_ram_bank_size();
+
+  for (std::size_t page = 0xA0; page < 0xC0; page++) {
+    std::size_t offset = (page - 0xA0) << 8;
+    uint8_t *data = ram != nullptr && offset < size ? ram + offset : nullptr;
+    m_read_pages[page] = data;
+    m_write_pages[page] = data;
+  }
 }
 
-uint8_t Memory::read_rom(uint16_t addr) {
+uint16_t Memory::get_rom_bank(uint16_t addr) {
   if (addr < 0x100 && !this->is_boot_rom_disabled())
-    return static_cast<uint8_t>(m_boot_rom[addr]);
+    return BOOT_ROM_BANK;
 
-  return m_cartridge.read(addr);
+  if (addr < 0x4000)
+    return m_cartridge.get_rom_bank0();
+  if (addr < 0x8000)
+    return m_cartridge.get_rom_bank();
+
+  return 0;
 }
 
-uint8_t Memory::read_ram(uint16_t addr) { return addr; }
-uint8_t Memory::read_vram(uint16_t addr) { return addr; }
-uint8_t Memory::read_mbc_rom(uint16_t addr) { return addr; }
-uint8_t Memory::read_mbc_ram(uint16_t addr) { return addr; }
-uint8_t Memory::read_high_memory(uint16_t addr) { return addr; }
-uint8_t Memory::read_banked_ram(uint16_t addr) { return addr; }
+void Memory::skip_boot() {
+  // The logo from the cartridge header scaled up twice, every nibble is a
+  // row and every row is drawn twice. Tiles start at 1, in the low bit plane.
+  // VRAM is written the usual way so the PPU hears about it.
+  uint16_t tile = 0x8010;
+  for (uint16_t addr = 0x104; addr < 0x134; addr++) {
+    uint8_t logo = m_cartridge.read(addr);
+    for (int nibble : {logo >> 4, logo & 0x0F}) {
+      uint8_t row = 0;
+      for (int bit = 3; bit >= 0; bit--)
+        row = row << 2 | ((nibble >> bit) & 0x01) * 0x03;
+      write_vram(tile, row);
+      write_vram(tile + 2, row);
+      tile += 4;
+    }
+  }
+  for (uint8_t row : REGISTERED_TILE) {
+    write_vram(tile, row);
+    tile += 2;
+  }
 
-void Memory::write_memory(uint16_t addr, uint8_t value) {
-  if (m_write_map.count(addr)) {
-    auto write_method = m_write_map.find(addr)->second;
-    return (this->*write_method)(addr, value);
+  // Tiles 1-12 over 13-24 in the middle of the background, the ® at the end
+  // of the top row.
+  for (uint8_t i = 0; i < 12; i++) {
+    write_vram(0x9904 + i, 0x01 + i);
+    write_vram(0x9924 + i, 0x0D + i);
   }
+  write_vram(0x9910, 0x19);
+
+  // Sound is on, with channel 1 still playing the second note of the chime.
+  // Only the readable bits of these show, the rest read as 1.
+  write_io(SOUND_ON, 0x80);
+  write_io(SOUND_1_LENGTH, 0x80);
+  write_io(SOUND_1_ENVELOPE, 0xF3);
+  write_io(SOUND_1_FREQUENCY_LOW, 0xC1);
+  write_io(SOUND_1_FREQUENCY_HIGH, 0x87);
+  write_io(SOUND_VOLUME, 0x77);
+  write_io(SOUND_PANNING, 0xF3);
+  set_io(SOUND_ON, 0x81);
+
+  write_io(LCD_CONTROL, 0x91);
+  write_io(BACKGROUND_PALETTE, 0xFC);
+  // No transfer was started, but DMA reads 0xFF after the boot ROM.
+  set_io(OAM_DMA, 0xFF);
+  // The LCD ran for a while with interrupts off.
+  write_io(INTERRUPT_FLAG, VBLANK_INTERRUPT);
+  write_io(BOOT_ROM_DISABLE, 0x01);
 }
 
-void Memory::write_mbc(uint16_t addr, uint8_t value) { return; }
-void Memory::write_ram(uint16_t addr, uint8_t value) { return; }
-void Memory::write_mbc_ram(uint16_t addr, uint8_t value) { return; }
-void Memory::write_vram(uint16_t addr, uint8_t value) { return; }
-void Memory::write_banked_ram(uint16_t addr, uint8_t value) { return; }
+// ROM pages past the end of the cartridge.
+uint8_t Memory::read_open_bus(uint16_t addr) { return 0xFF; }
 
-void Memory::write_high_memory(uint16_t addr, uint8_t value) {
-  if (addr < 0xFF80) {
-    switch (addr & 0xFF) {
-    case 0x50:
-      m_boot_rom_disabled = true;
-    }
+uint8_t Memory::read_mbc_ram(uint16_t addr) {
+  return m_cartridge.read_ram(addr);
+}
+
+// 0xFEA0-0xFEFF isn't usable, it reads as 0.
+uint8_t Memory::read_oam(uint16_t addr) {
+  if (m_oam_dma)
+    return 0xFF;
+  return addr < 0xFEA0 ? m_oam[addr - 0xFE00] : 0x00;
+}
+
+// Only the timer and PPU registers change with time alone, they catch up to
+// the current cycle when they're read.
+uint64_t Memory::next_change(uint16_t addr, uint64_t cycle) {
+  switch (addr) {
+  case 0xFF04:
+    return m_gb.get_timer().next_divider_change(cycle);
+  case 0xFF05:
+    return m_gb.get_timer().next_counter_change(cycle);
+  case 0xFF41:
+  case 0xFF44:
+    return m_gb.get_ppu().next_change(cycle);
+  }
+  return NEVER;
+}
+
+// Bank switches only move the page pointers, reads never reach the mapper.
+void Memory::write_mbc(uint16_t addr, uint8_t value) {
+  m_cartridge.write(addr, value);
+  map_rom();
+  map_external_ram();
+}
+
+void Memory::write_mbc_ram(uint16_t addr, uint8_t value) {
+  m_cartridge.write_ram(addr, value);
+}
+
+void Memory::write_vram(uint16_t addr, uint8_t value) {
+  uint16_t offset = addr - 0x8000;
+  if (m_vram[offset] == value)
+    return;
+
+  PPU &ppu = m_gb.get_ppu();
+  ppu.catch_up();
+  m_vram[offset] = value;
+  ppu.write(addr, value);
+}
+
+void Memory::write_oam(uint16_t addr, uint8_t value) {
+  if (addr >= 0xFEA0 || m_oam_dma)
+    return;
+
+  PPU &ppu = m_gb.get_ppu();
+  ppu.catch_up();
+  m_oam[addr - 0xFE00] = value;
+  ppu.write(addr, value);
+}
+
+// The whole transfer happens at once, only OAM being locked is spread over
+// the time it takes. Nothing else on the bus is locked, games run their DMA
+// routine from HRAM and wait it out anyway.
+void Memory::start_oam_dma(uint8_t page) {
+  PPU &ppu = m_gb.get_ppu();
+  ppu.catch_up();
+  m_io[OAM_DMA] = page;
+  if (const uint8_t *source = m_read_pages[page]) {
+    std::copy_n(source, m_oam.size(), m_oam.begin());
+  } else {
+    for (std::size_t i = 0; i < m_oam.size(); i++)
+      m_oam[i] = read_memory(page << 8 | i);
   }
+  for (std::size_t i = 0; i < m_oam.size(); i++)
+    ppu.write(0xFE00 + i, m_oam[i]);
+
+  m_oam_dma = true;
+  m_gb.schedule(Event::OAM_DMA_END, m_gb.get_cycles() + OAM_DMA_CYCLES);
 }
 
 } // namespace gb
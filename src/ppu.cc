@@ -2,25 +2,165 @@
 
 #include "gameboy.h"
 
+#include <algorithm>
+
 namespace gb {
 
-PPU::PPU(Gameboy &gb) : m_gb(gb), m_mem(m_gb.get_memory()) {}
+constexpr uint8_t VISIBLE_LINES = SCREEN_HEIGHT;
+
+// Mode timings are in clock cycles, the scheduler counts machine cycles.
+constexpr uint64_t LINE_MACHINE_CYCLES = LINE_CYCLES / 4;
+constexpr uint64_t FRAME_MACHINE_CYCLES = FRAME_CYCLES / 4;
+constexpr uint64_t VBLANK_START = VISIBLE_LINES * LINE_MACHINE_CYCLES;
+// Into a visible line.
+constexpr uint64_t ACCESS_VRAM_START = ACCESS_OAM_CYCLES / 4;
+constexpr uint64_t HBLANK_START = (ACCESS_OAM_CYCLES + ACCESS_VRAM_CYCLES) / 4;
+// LY only reads 153 for the first machine cycle of the last line, then 0 for
+// the rest of it.
+constexpr uint8_t LAST_LINE = 153;
+constexpr uint64_t LAST_LINE_START = LAST_LINE * LINE_MACHINE_CYCLES;
+constexpr uint64_t LAST_LINE_Y_CYCLES = 1;
+
+#if defined(GAMERBOY_PARALLEL_PPU)
+PPU::PPU(Gameboy &gb)
+    : m_gb(gb), m_mem(m_gb.get_memory()), m_renderer(m_gb.get_frames()) {
+  m_renderer.clear();
+}
+#else
+PPU::PPU(Gameboy &gb)
+    : m_gb(gb), m_mem(m_gb.get_memory()), m_frames(m_gb.get_frames()),
+      m_renderer({m_mem.get_vram(), m_mem.get_oam(), m_mem.get_io_data()}) {
+  m_renderer.set_target(m_frames.get_back().pixels,
+                        m_frames.get_back().pitch);
+  m_renderer.clear();
+}
+#endif
+
+void PPU::vblank(uint64_t cycle) {
+  sync(cycle);
+  render(cycle);
+  m_frame_start = cycle - VBLANK_START + FRAME_MACHINE_CYCLES;
+  m_next_line = 0;
+  m_renderer.start_frame();
+
+  m_gb.get_cpu().request_interrupt(VBLANK_INTERRUPT);
+  m_gb.schedule(Event::VBLANK, cycle + FRAME_MACHINE_CYCLES);
+}
 
-void PPU::cycle(uint64_t cycle) {
-  switch (m_current_video_mode) {
+void PPU::write_lcd_control(uint8_t value) {
+  uint64_t cycle = m_gb.get_cycles();
+  sync(cycle);
+  render(cycle);
 
-  case VideoMode::ACCESS_OAM:
-    break;
-  case VideoMode::ACCESS_VRAM:
-    break;
-  case VideoMode::HBLANK:
-    break;
-  case VideoMode::VBLANK:
-    break;
+  bool was_enabled = is_enabled();
+  m_mem.set_io(LCD_CONTROL, value);
+  m_renderer.write(0xFF00 | LCD_CONTROL, value);
+  if (was_enabled == is_enabled())
+    return;
 
-  default:
-    utility::error("Should not be here!", 3);
+  m_line_y.set_register(0);
+  if (is_enabled()) {
+    m_enabled_cycle = cycle;
+    m_frame_start = cycle;
+    m_next_line = 0;
+    m_renderer.start_frame();
+    m_current_video_mode = VideoMode::ACCESS_OAM;
+    m_gb.schedule(Event::VBLANK, cycle + VBLANK_START);
+  } else {
+    // The screen goes blank.
+    m_renderer.clear();
+    m_gb.get_scheduler().cancel(Event::VBLANK);
+    m_current_video_mode = VideoMode::HBLANK;
   }
 }
 
+void PPU::skip_boot(uint64_t cycle) {
+  // The boot ROM hands over in the last line of VBlank, once LY has gone back
+  // to 0. That makes the frame start before cycle 0, the unsigned arithmetic
+  // in `sync` still comes out right.
+  uint64_t frame_cycle = LAST_LINE_START + LAST_LINE_Y_CYCLES;
+  m_enabled_cycle = cycle - frame_cycle;
+  m_frame_start = m_enabled_cycle + FRAME_MACHINE_CYCLES;
+  m_next_line = 0;
+  m_gb.schedule(Event::VBLANK, m_frame_start + VBLANK_START);
+  sync(cycle);
+}
+
+uint8_t PPU::read_lcd_status() {
+  sync(m_gb.get_cycles());
+  uint8_t coincidence =
+      m_line_y.get_register() == m_mem.get_io(LINE_Y_COMPARE) ? 0x04 : 0;
+  return m_mem.get_io(LCD_STATUS) | coincidence |
+         static_cast<uint8_t>(m_current_video_mode);
+}
+
+uint8_t PPU::read_line_y() {
+  sync(m_gb.get_cycles());
+  return m_line_y.get_register();
+}
+
+void PPU::finish_frame() {
+#if defined(GAMERBOY_PARALLEL_PPU)
+  m_renderer.finish_frame();
+#else
+  m_frames.publish();
+  m_renderer.set_target(m_frames.get_back().pixels,
+                        m_frames.get_back().pitch);
+#endif
+  if (!is_enabled())
+    m_renderer.clear();
+}
+
+void PPU::catch_up() { render(m_gb.get_cycles()); }
+
+uint64_t PPU::next_change(uint64_t cycle) {
+  if (!is_enabled())
+    return NEVER;
+
+  uint64_t frame_cycle = (cycle - m_enabled_cycle) % FRAME_MACHINE_CYCLES;
+  uint64_t line_cycle = frame_cycle % LINE_MACHINE_CYCLES;
+  uint64_t next = LINE_MACHINE_CYCLES;
+  if (frame_cycle == LAST_LINE_START)
+    next = LAST_LINE_Y_CYCLES;
+  else if (frame_cycle < VBLANK_START && line_cycle < ACCESS_VRAM_START)
+    next = ACCESS_VRAM_START;
+  else if (frame_cycle < VBLANK_START && line_cycle < HBLANK_START)
+    next = HBLANK_START;
+  return cycle + next - line_cycle;
+}
+
+void PPU::sync(uint64_t cycle) {
+  // While the LCD is off LY and the mode stay where turning it off left them.
+  if (cycle == m_synced_cycle || !is_enabled())
+    return;
+  m_synced_cycle = cycle;
+
+  uint64_t frame_cycle = (cycle - m_enabled_cycle) % FRAME_MACHINE_CYCLES;
+  uint64_t line_cycle = frame_cycle % LINE_MACHINE_CYCLES;
+  uint64_t line = frame_cycle / LINE_MACHINE_CYCLES;
+  if (frame_cycle >= LAST_LINE_START + LAST_LINE_Y_CYCLES)
+    line = 0;
+  m_line_y.set_register(line);
+
+  if (frame_cycle >= VBLANK_START)
+    m_current_video_mode = VideoMode::VBLANK;
+  else if (line_cycle < ACCESS_VRAM_START)
+    m_current_video_mode = VideoMode::ACCESS_OAM;
+  else if (line_cycle < HBLANK_START)
+    m_current_video_mode = VideoMode::ACCESS_VRAM;
+  else
+    m_current_video_mode = VideoMode::HBLANK;
+}
+
+void PPU::render(uint64_t cycle) {
+  if (!is_enabled() || cycle < m_frame_start + ACCESS_VRAM_START)
+    return;
+
+  uint64_t lines =
+      (cycle - m_frame_start - ACCESS_VRAM_START) / LINE_MACHINE_CYCLES + 1;
+  lines = std::min<uint64_t>(lines, VISIBLE_LINES);
+  for (; m_next_line < lines; m_next_line++)
+    m_renderer.draw_line(m_next_line);
+}
+
 } // namespace gb
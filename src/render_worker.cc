@@ -0,0 +1,63 @@
+#include "render_worker.h"
+
+namespace gb {
+
+RenderWorker::RenderWorker(FrameMailbox &frames)
+    : m_frames(frames),
+      m_thread([this](std::stop_token stop) { run(stop); }) {
+  m_renderer.set_target(m_frames.get_back().pixels,
+                        m_frames.get_back().pitch);
+}
+
+RenderWorker::~RenderWorker() {
+  m_idle.acquire();
+  m_thread.request_stop();
+  m_submitted.release();
+}
+
+void RenderWorker::finish_frame() {
+  m_idle.acquire();
+  std::swap(m_recording, m_drawing);
+  m_recording.clear();
+  m_submitted.release();
+}
+
+void RenderWorker::run(std::stop_token stop) {
+  while (true) {
+    m_submitted.acquire();
+    if (stop.stop_requested())
+      return;
+
+    for (const Command &command : m_drawing)
+      replay(command);
+    m_frames.publish();
+    m_renderer.set_target(m_frames.get_back().pixels,
+                          m_frames.get_back().pitch);
+    m_idle.release();
+  }
+}
+
+void RenderWorker::replay(const Command &command) {
+  switch (command.type) {
+  case Command::START_FRAME:
+    m_renderer.start_frame();
+    break;
+  case Command::DRAW_LINE:
+    m_renderer.draw_line(command.value);
+    break;
+  case Command::CLEAR:
+    m_renderer.clear();
+    break;
+  case Command::WRITE:
+    if (command.address < 0xA000)
+      m_vram[command.address - 0x8000] = command.value;
+    else if (command.address < 0xFF00)
+      m_oam[command.address - 0xFE00] = command.value;
+    else
+      m_io[command.address - 0xFF00] = command.value;
+    m_renderer.write(command.address, command.value);
+    break;
+  }
+}
+
+} // namespace gb
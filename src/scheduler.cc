@@ -0,0 +1,84 @@
+#include "scheduler.h"
+
+namespace gb {
+
+Scheduler::Scheduler() { m_position.fill(NOT_SCHEDULED); }
+
+void Scheduler::schedule(Event event, uint64_t cycle) {
+  std::size_t index = m_position[static_cast<std::size_t>(event)];
+  if (index == NOT_SCHEDULED) {
+    index = m_size++;
+    place(index, {event, cycle});
+    sift_up(index);
+    return;
+  }
+
+  uint64_t previous = m_heap[index].cycle;
+  m_heap[index].cycle = cycle;
+  if (cycle < previous)
+    sift_up(index);
+  else
+    sift_down(index);
+}
+
+void Scheduler::cancel(Event event) {
+  std::size_t index = m_position[static_cast<std::size_t>(event)];
+  if (index != NOT_SCHEDULED)
+    remove(index);
+}
+
+std::optional<ScheduledEvent> Scheduler::pop_due(uint64_t cycle) {
+  if (m_size == 0 || m_heap[0].cycle > cycle)
+    return std::nullopt;
+
+  ScheduledEvent due = m_heap[0];
+  remove(0);
+  return due;
+}
+
+void Scheduler::place(std::size_t index, const ScheduledEvent &entry) {
+  m_heap[index] = entry;
+  m_position[static_cast<std::size_t>(entry.event)] = index;
+}
+
+void Scheduler::sift_up(std::size_t index) {
+  ScheduledEvent entry = m_heap[index];
+  while (index > 0) {
+    std::size_t parent = (index - 1) / 2;
+    if (!before(entry, m_heap[parent]))
+      break;
+    place(index, m_heap[parent]);
+    index = parent;
+  }
+  place(index, entry);
+}
+
+void Scheduler::sift_down(std::size_t index) {
+  ScheduledEvent entry = m_heap[index];
+  while (true) {
+    std::size_t child = index * 2 + 1;
+    if (child >= m_size)
+      break;
+    if (child + 1 < m_size && before(m_heap[child + 1], m_heap[child]))
+      child++;
+    if (!before(m_heap[child], entry))
+      break;
+    place(index, m_heap[child]);
+    index = child;
+  }
+  place(index, entry);
+}
+
+void Scheduler::remove(std::size_t index) {
+  m_position[static_cast<std::size_t>(m_heap[index].event)] = NOT_SCHEDULED;
+  if (index == --m_size)
+    return;
+
+  // The last entry fills the hole, and can belong above or below it.
+  Event moved = m_heap[m_size].event;
+  place(index, m_heap[m_size]);
+  sift_up(index);
+  sift_down(m_position[static_cast<std::size_t>(moved)]);
+}
+
+} // namespace gb
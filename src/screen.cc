@@ -0,0 +1,101 @@
+#include "screen.h"
+
+#include "gameboy.h"
+
+#include <thread>
+
+namespace gb {
+
+static utility::sdl_window_ptr create_window() {
+  SDL_Init(SDL_INIT_VIDEO);
+
+  utility::sdl_window_ptr window(
+      SDL_CreateWindow("gamerboy", SDL_WINDOWPOS_UNDEFINED,
+                       SDL_WINDOWPOS_UNDEFINED, 320, 288, SDL_WINDOW_OPENGL),
+      SDL_DestroyWindow);
+
+  if (window == nullptr)
+    utility::error("Unable to create window", 1);
+  return window;
+}
+
+static utility::sdl_renderer_ptr create_renderer(SDL_Window *window) {
+  return {SDL_CreateRenderer(window, -1,
+                             SDL_RENDERER_ACCELERATED |
+                                 SDL_RENDERER_PRESENTVSYNC),
+          SDL_DestroyRenderer};
+}
+
+// Scaled up to the window when it's drawn.
+static utility::sdl_texture_ptr create_texture(SDL_Renderer *renderer) {
+  return {SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                            SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH,
+                            SCREEN_HEIGHT),
+          SDL_DestroyTexture};
+}
+
+// Locking hands out memory SDL uploads from when the texture is unlocked, so
+// frames are drawn into it directly.
+static FrameTarget lock_texture(SDL_Texture *texture) {
+  void *pixels = nullptr;
+  int pitch = 0;
+  if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0)
+    utility::error("Unable to lock texture", 1);
+  return {static_cast<uint32_t *>(pixels), static_cast<std::size_t>(pitch)};
+}
+
+Screen::Screen()
+    : m_window(create_window()), m_renderer(create_renderer(m_window.get())),
+      m_textures{create_texture(m_renderer.get()),
+                 create_texture(m_renderer.get()),
+                 create_texture(m_renderer.get())},
+      m_frames(lock_texture(m_textures[0].get()),
+               lock_texture(m_textures[1].get())) {}
+
+Screen::~Screen() {
+  // TODO: Not sure why I have to manually use the destroy functions now,
+  // something happened with `std::unique_ptr`?
+  for (utility::sdl_texture_ptr &texture : m_textures)
+    SDL_DestroyTexture(texture.get());
+  SDL_DestroyRenderer(m_renderer.get());
+  SDL_DestroyWindow(m_window.get());
+  SDL_Quit();
+}
+
+void Screen::show(Gameboy &gameboy) {
+  // Stopped and joined when it goes out of scope.
+  std::jthread emulation(
+      [&gameboy](std::stop_token stop) { gameboy.emulate(stop); });
+  while (!did_quit()) {
+    process();
+    present();
+  }
+}
+
+void Screen::process() {
+  SDL_Event e;
+  while (SDL_PollEvent(&e)) {
+    switch (e.type) {
+    case SDL_QUIT:
+      m_did_close = true;
+      break;
+    }
+  }
+}
+
+// Only holds up this thread, the emulator carries on.
+void Screen::present() {
+  // The texture shown until now is locked again before the emulator gets it
+  // back, the new one is unlocked so it can be drawn.
+  if (m_frames.has_fresh()) {
+    m_frames.set_front(lock_texture(m_textures[m_frames.get_front()].get()));
+    SDL_UnlockTexture(m_textures[m_frames.take()].get());
+  }
+
+  SDL_Texture *texture = m_textures[m_frames.get_front()].get();
+  SDL_RenderClear(m_renderer.get());
+  SDL_RenderCopy(m_renderer.get(), texture, nullptr, nullptr);
+  SDL_RenderPresent(m_renderer.get());
+}
+
+} // namespace gb
@@ -0,0 +1,94 @@
+#include "timer.h"
+
+#include "gameboy.h"
+
+namespace gb {
+
+Timer::Timer(Gameboy &gb) : m_gb(gb), m_mem(m_gb.get_memory()) {}
+
+void Timer::overflow(uint64_t cycle) {
+  sync(cycle);
+  m_gb.get_cpu().request_interrupt(TIMER_INTERRUPT);
+  schedule_overflow();
+}
+
+uint8_t Timer::read_divider() {
+  return divider_clocks(m_gb.get_cycles()) >> 8;
+}
+
+void Timer::write_divider(uint8_t value) {
+  uint64_t cycle = m_gb.get_cycles();
+  sync(cycle);
+  m_divider_reset = cycle;
+  schedule_overflow();
+}
+
+uint8_t Timer::read_counter() {
+  sync(m_gb.get_cycles());
+  return m_counter.get_register();
+}
+
+void Timer::write_counter(uint8_t value) {
+  sync(m_gb.get_cycles());
+  m_counter.set_register(value);
+  schedule_overflow();
+}
+
+void Timer::write_modulo(uint8_t value) {
+  sync(m_gb.get_cycles());
+  m_mem.set_io(TIMER_MODULO, value);
+}
+
+void Timer::write_control(uint8_t value) {
+  sync(m_gb.get_cycles());
+  m_mem.set_io(TIMER_CONTROL, value);
+  schedule_overflow();
+}
+
+uint64_t Timer::next_divider_change(uint64_t cycle) {
+  return m_divider_reset + (divider_clocks(cycle) / 256 + 1) * 256 / 4;
+}
+
+uint64_t Timer::next_counter_change(uint64_t cycle) {
+  if (!is_enabled())
+    return NEVER;
+
+  uint32_t period = counter_period();
+  return m_divider_reset + (divider_clocks(cycle) / period + 1) * period / 4;
+}
+
+void Timer::sync(uint64_t cycle) {
+  // The overflow event can come after a read already caught up past it.
+  if (cycle <= m_synced_cycle)
+    return;
+
+  if (is_enabled()) {
+    uint32_t period = counter_period();
+    uint64_t counter = m_counter.get_register() +
+                       divider_clocks(cycle) / period -
+                       divider_clocks(m_synced_cycle) / period;
+    // After the first overflow TIMA wraps every 0x100 - TMA increments.
+    if (counter > 0xFF) {
+      uint8_t modulo = m_mem.get_io(TIMER_MODULO);
+      counter = modulo + (counter - 0x100) % (0x100 - modulo);
+    }
+    m_counter.set_register(counter);
+  }
+  m_synced_cycle = cycle;
+}
+
+void Timer::schedule_overflow() {
+  if (!is_enabled()) {
+    m_gb.get_scheduler().cancel(Event::TIMER_OVERFLOW);
+    return;
+  }
+
+  // TIMA overflows on its (0x100 - TIMA)th increment from here.
+  uint32_t period = counter_period();
+  uint64_t increments = 0x100 - m_counter.get_register();
+  uint64_t clocks =
+      (divider_clocks(m_synced_cycle) / period + increments) * period;
+  m_gb.schedule(Event::TIMER_OVERFLOW, m_divider_reset + clocks / 4);
+}
+
+} // namespace gb
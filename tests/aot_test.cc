@@ -0,0 +1,205 @@
+// Runs the instruction streams of the ROM `gamerboy-aot-test-rom` writes
+// through the interpreter and through the blocks `gamerboy-aot` translated
+// from it, from the same random register states, and checks the register
+// file, flags, PC and cycle counts come out identical. Half the runs stop at
+// a deadline inside the stream.
+//
+// Usage: gamerboy-aot-test <rom>
+
+#include "aot.h"
+#include "gameboy.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace gb {
+
+struct Snapshot {
+  std::array<uint16_t, WORD_REGISTER_LENGTH> pairs;
+  uint16_t pc;
+  uint64_t cycles;
+
+  bool operator==(const Snapshot &) const = default;
+};
+
+struct Stream {
+  uint16_t address = 0;
+  // Including the jump that ends it.
+  std::size_t instructions = 0;
+};
+
+struct AotTest {
+  CPU &cpu;
+
+  bool enabled() const { return cpu.m_aot_enabled; }
+
+  const AotBlock *find(uint16_t address) const {
+    return Aot::find((cpu.m_memory.get_rom_bank(address) << 16) | address);
+  }
+
+  void load(const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs,
+            uint16_t pc) {
+    for (std::size_t i = 0; i < pairs.size(); i++)
+      cpu.m_registers[i] = pairs[i];
+    cpu.set_flags(pairs[Registers::AF] & 0xF0);
+    cpu.m_registers.pc = pc;
+  }
+
+  Snapshot save(uint64_t cycles) {
+    cpu.get_flags();
+    Snapshot snapshot{{}, cpu.m_registers.pc, cycles};
+    for (std::size_t i = 0; i < snapshot.pairs.size(); i++)
+      snapshot.pairs[i] = cpu.m_registers[i];
+    return snapshot;
+  }
+
+  // Stops at the first instruction that reaches `deadline`, like `CPU::run`.
+  Snapshot interpret(const Stream &stream,
+                     const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs,
+                     uint64_t deadline) {
+    load(pairs, stream.address);
+    uint64_t cycles = 0;
+    for (std::size_t i = 0; i < stream.instructions && cycles < deadline; i++)
+      cycles += cpu.cycle();
+    return save(cycles);
+  }
+
+  // The same steps `CPU::run` takes around a block, in a batch that ends at
+  // `deadline`.
+  Snapshot translated(const AotBlock &block,
+                      const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs,
+                      uint64_t deadline) {
+    load(pairs, block.key & 0xFFFF);
+    cpu.m_batch_cycles = deadline;
+    cpu.m_batch_elapsed = 0;
+    uint64_t cycles = block.run(cpu);
+    cpu.m_exit_block = false;
+    cpu.m_batch_cycles = 0;
+    return save(cycles);
+  }
+};
+
+} // namespace gb
+
+using namespace gb;
+
+// Random register states each stream runs from.
+constexpr int RUNS = 64;
+
+// Follows the jumps from the entry point, every stream ends in one. The last
+// jumps to a `jr` to itself.
+static std::vector<Stream> find_streams(const std::vector<uint8_t> &rom) {
+  std::vector<Stream> streams;
+  uint16_t address = 0x0100;
+  while (true) {
+    Stream stream{address, 0};
+    uint16_t pc = address;
+    uint16_t target = 0;
+    while (true) {
+      uint8_t opcode = rom[pc];
+      stream.instructions++;
+      pc += OPCODE_LENGTH[opcode];
+      if (opcode == 0xC3) {
+        target = rom[pc - 2] | rom[pc - 1] << 8;
+        break;
+      }
+      if (opcode == 0x18) {
+        target = pc + static_cast<int8_t>(rom[pc - 1]);
+        break;
+      }
+    }
+
+    if (target == address)
+      return streams;
+    if (address != 0x0100)
+      streams.push_back(stream);
+    address = target;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: gamerboy-aot-test <rom>\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> rom;
+  {
+    std::ifstream input(argv[1], std::ios::binary);
+    rom.assign(std::istreambuf_iterator<char>(input),
+               std::istreambuf_iterator<char>());
+  }
+  if (rom.size() != 0x8000) {
+    std::fprintf(stderr, "%s isn't the generated test ROM\n", argv[1]);
+    return 1;
+  }
+  std::vector<Stream> streams = find_streams(rom);
+
+  std::array<uint32_t, 2 * SCREEN_WIDTH * SCREEN_HEIGHT> pixels{};
+  FrameMailbox frames({pixels.data(), SCREEN_WIDTH * sizeof(uint32_t)},
+                      {pixels.data() + SCREEN_WIDTH * SCREEN_HEIGHT,
+                       SCREEN_WIDTH * sizeof(uint32_t)});
+  Gameboy gameboy(argv[1], frames, {.skip = true});
+  AotTest test{gameboy.get_cpu()};
+  if (!test.enabled()) {
+    std::fprintf(stderr, "The blocks weren't translated from %s\n", argv[1]);
+    return 1;
+  }
+
+  std::mt19937 random(0x61);
+  int failures = 0;
+  for (const Stream &stream : streams) {
+    const AotBlock *block = test.find(stream.address);
+    if (block == nullptr) {
+      std::fprintf(stderr, "No block for the stream at 0x%04X\n",
+                   stream.address);
+      failures++;
+      continue;
+    }
+
+    for (int run = 0; run < RUNS; run++) {
+      std::array<uint16_t, WORD_REGISTER_LENGTH> pairs;
+      for (uint16_t &pair : pairs)
+        pair = static_cast<uint16_t>(random());
+
+      uint64_t deadline = std::numeric_limits<uint64_t>::max();
+      Snapshot expected = test.interpret(stream, pairs, deadline);
+      if (run % 2 == 1) {
+        deadline = 1 + random() % expected.cycles;
+        expected = test.interpret(stream, pairs, deadline);
+      }
+      Snapshot actual = test.translated(*block, pairs, deadline);
+      if (expected == actual)
+        continue;
+
+      if (failures++ < 20) {
+        std::fprintf(stderr, "Mismatch in the stream at 0x%04X, opcode 0x%02X:",
+                     stream.address, rom[stream.address]);
+        const char *names[] = {"AF", "BC", "DE", "HL", "SP"};
+        for (std::size_t i = 0; i < pairs.size(); i++)
+          std::fprintf(stderr, " %s %04X/%04X", names[i], expected.pairs[i],
+                       actual.pairs[i]);
+        std::fprintf(stderr, " PC %04X/%04X cycles %llu/%llu\n", expected.pc,
+                     actual.pc,
+                     static_cast<unsigned long long>(expected.cycles),
+                     static_cast<unsigned long long>(actual.cycles));
+      }
+    }
+  }
+
+  if (streams.empty()) {
+    std::fprintf(stderr, "No instruction streams in %s\n", argv[1]);
+    return 1;
+  }
+  if (failures != 0) {
+    std::fprintf(stderr, "%d of %zu runs differ\n", failures,
+                 streams.size() * RUNS);
+    return 1;
+  }
+  std::printf("%zu instruction streams match\n", streams.size());
+  return 0;
+}
@@ -0,0 +1,63 @@
+// Writes the ROM `gamerboy-aot-test` checks the ahead of time recompiler
+// with: every opcode `gamerboy-aot` emits natively on its own, and random
+// mixes of them, chained together with `jp` and `jr`.
+//
+// Usage: gamerboy-aot-test-rom <output.gb>
+
+#include "instruction_streams.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace gb;
+
+// Register operands, without (HL).
+constexpr std::array<uint8_t, 7> REGISTER_OPERANDS = {0, 1, 2, 3, 4, 5, 7};
+
+// Every opcode besides `jp` and `jr` that `gamerboy-aot` writes out directly,
+// with its length.
+static std::vector<std::pair<uint8_t, uint8_t>> native_opcodes() {
+  std::vector<std::pair<uint8_t, uint8_t>> opcodes = {{0x00, 1}};
+
+  // ld r,r
+  for (uint8_t dst : REGISTER_OPERANDS)
+    for (uint8_t src : REGISTER_OPERANDS)
+      opcodes.push_back({0x40 | dst << 3 | src, 1});
+  // alu a,r
+  for (uint8_t operation = 0; operation < 8; operation++)
+    for (uint8_t src : REGISTER_OPERANDS)
+      opcodes.push_back({0x80 | operation << 3 | src, 1});
+  // alu a,d8
+  for (uint8_t operation = 0; operation < 8; operation++)
+    opcodes.push_back({0xC6 | operation << 3, 2});
+  // ld r,d8
+  for (uint8_t r : REGISTER_OPERANDS)
+    opcodes.push_back({0x06 | r << 3, 2});
+  // ld rr,d16, inc rr, dec rr for BC, DE, HL and SP
+  for (uint8_t rr = 0; rr < 4; rr++) {
+    opcodes.push_back({0x01 | rr << 4, 3});
+    opcodes.push_back({0x03 | rr << 4, 1});
+    opcodes.push_back({0x0B | rr << 4, 1});
+  }
+  return opcodes;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: gamerboy-aot-test-rom <output.gb>\n";
+    return 1;
+  }
+
+  std::mt19937 random(0x41);
+  std::vector<Stream> streams = random_streams(native_opcodes(), 200, random);
+  std::vector<uint8_t> rom = build_rom(streams);
+  // The emulator only runs the blocks for a cartridge with this header, the
+  // other tests' ROMs leave it empty.
+  std::memcpy(rom.data() + 0x134, "AOT TEST", 8);
+
+  std::ofstream output(argv[1], std::ios::binary);
+  output.write(reinterpret_cast<const char *>(rom.data()), rom.size());
+  return output.good() ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+// Composites random lines through every compositor the host runs, and checks
+// they come out byte for byte the same as the scalar one.
+
+#include "compositor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace gb;
+
+// Random lines and palettes composited.
+constexpr int RUNS = 10000;
+// Pixels in a line, a multiple of 32.
+constexpr std::size_t COUNT = 160;
+
+int main() {
+  std::vector<std::pair<const char *, compositor_t>> compositors;
+#if defined(__x86_64__)
+  compositors.push_back({"SSE2", composite_sse2});
+  if (__builtin_cpu_supports("avx2"))
+    compositors.push_back({"AVX2", composite_avx2});
+  else
+    std::printf("No AVX2 on this CPU, skipping it\n");
+#endif
+
+  std::mt19937 random(0x47);
+  std::array<uint8_t, COUNT> background, sprites, sprite_flags;
+  std::array<uint32_t, COUNT> expected, actual;
+
+  int failures = 0;
+  for (int run = 0; run < RUNS; run++) {
+    for (std::size_t x = 0; x < COUNT; x++) {
+      background[x] = random() % 4;
+      sprites[x] = random() % 4;
+      sprite_flags[x] = random() % 4;
+    }
+    Palettes palettes{static_cast<uint8_t>(random()),
+                      static_cast<uint8_t>(random()),
+                      static_cast<uint8_t>(random())};
+    LineLayers layers{background.data(), sprites.data(), sprite_flags.data()};
+
+    composite_scalar(layers, COUNT, palettes, expected.data());
+    for (auto [name, composite] : compositors) {
+      actual.fill(0);
+      composite(layers, COUNT, palettes, actual.data());
+      if (std::memcmp(expected.data(), actual.data(), sizeof(expected)) == 0)
+        continue;
+
+      if (failures++ < 20) {
+        std::size_t x = 0;
+        while (expected[x] == actual[x])
+          x++;
+        std::fprintf(stderr,
+                     "%s differs at pixel %zu: %08X instead of %08X, "
+                     "background %u sprite %u flags %u, palettes "
+                     "%02X %02X %02X\n",
+                     name, x, actual[x], expected[x], background[x],
+                     sprites[x], sprite_flags[x], palettes.background,
+                     palettes.object_0, palettes.object_1);
+      }
+    }
+  }
+
+  if (failures != 0) {
+    std::fprintf(stderr, "%d lines differ\n", failures);
+    return 1;
+  }
+  std::printf("%zu compositors match the scalar one\n", compositors.size());
+  return 0;
+}
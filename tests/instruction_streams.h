@@ -0,0 +1,93 @@
+#pragma once
+
+// Random runs of instructions laid out in a ROM, for the tests that check a
+// CPU engine against the interpreter.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace gb {
+
+struct Stream {
+  uint16_t address = 0;
+  // Including the jump that ends it.
+  std::size_t instructions = 0;
+  std::vector<uint8_t> code;
+};
+
+// Each of `opcodes`, an opcode and its length, on its own, then `mixes` random
+// runs of them. Immediates are random.
+inline std::vector<Stream>
+random_streams(const std::vector<std::pair<uint8_t, uint8_t>> &opcodes,
+               int mixes, std::mt19937 &random) {
+  std::vector<Stream> streams;
+  auto append = [&](Stream &stream, uint8_t opcode, uint8_t length) {
+    stream.code.push_back(opcode);
+    for (uint8_t i = 1; i < length; i++)
+      stream.code.push_back(static_cast<uint8_t>(random()));
+    stream.instructions++;
+  };
+
+  for (auto [opcode, length] : opcodes)
+    append(streams.emplace_back(), opcode, length);
+  for (int i = 0; i < mixes; i++) {
+    Stream &stream = streams.emplace_back();
+    std::size_t count = 2 + random() % 48;
+    for (std::size_t j = 0; j < count; j++) {
+      auto [opcode, length] = opcodes[random() % opcodes.size()];
+      append(stream, opcode, length);
+    }
+  }
+  return streams;
+}
+
+// Lays `streams` out in a ROM only cartridge, the entry point jumps to the
+// first one and each jumps to the next, so PC is checked as well. Every other
+// one ends in a `jr`, where the next is in reach. The last jumps to a `jr` to
+// itself. None of them crosses into the next bank.
+inline std::vector<uint8_t> build_rom(std::vector<Stream> &streams) {
+  std::vector<uint8_t> rom(0x8000, 0x00);
+  uint16_t address = 0x0200;
+  for (Stream &stream : streams) {
+    std::size_t size = stream.code.size() + 3;
+    if (address < 0x4000 && address + size > 0x4000)
+      address = 0x4000;
+    if (address + size + 2 > 0x8000) {
+      std::fprintf(stderr, "Instruction streams don't fit in the ROM\n");
+      std::exit(1);
+    }
+    stream.address = address;
+    address += size;
+  }
+  rom[address] = 0x18;
+  rom[address + 1] = 0xFE;
+
+  // jp 0x0200
+  rom[0x0100] = 0xC3;
+  rom[0x0101] = 0x00;
+  rom[0x0102] = 0x02;
+
+  for (std::size_t i = 0; i < streams.size(); i++) {
+    Stream &stream = streams[i];
+    uint16_t next = i + 1 < streams.size() ? streams[i + 1].address : address;
+    int offset = next - (stream.address + stream.code.size() + 2);
+    if (i % 2 == 1 && offset >= -128 && offset < 128)
+      stream.code.insert(stream.code.end(),
+                         {0x18, static_cast<uint8_t>(offset)});
+    else
+      stream.code.insert(stream.code.end(),
+                         {0xC3, static_cast<uint8_t>(next & 0xFF),
+                          static_cast<uint8_t>(next >> 8)});
+    stream.instructions++;
+    std::copy(stream.code.begin(), stream.code.end(),
+              rom.begin() + stream.address);
+  }
+  return rom;
+}
+
+} // namespace gb
@@ -0,0 +1,73 @@
+// Runs `CPU::run_until` with deadlines that the instruction after EI, and
+// servicing an interrupt, take the CPU past. It has to return at once instead
+// of starting a batch that ends a wrapped number of cycles later.
+
+#include "gameboy.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace gb;
+
+static int failures = 0;
+
+static void check(bool passed, const char *what) {
+  if (passed)
+    return;
+  std::fprintf(stderr, "Failed: %s\n", what);
+  failures++;
+}
+
+int main() {
+  // ei, then a jr to itself at 0x0101 and at the VBlank vector.
+  std::vector<uint8_t> rom(0x8000, 0x00);
+  rom[0x0100] = 0xFB;
+  rom[0x0101] = 0x18;
+  rom[0x0102] = 0xFE;
+  rom[0x0040] = 0x18;
+  rom[0x0041] = 0xFE;
+
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "gamerboy-interrupt-test.gb";
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(rom.data()), rom.size());
+
+  std::array<uint32_t, 2 * SCREEN_WIDTH * SCREEN_HEIGHT> pixels{};
+  FrameMailbox frames({pixels.data(), SCREEN_WIDTH * sizeof(uint32_t)},
+                      {pixels.data() + SCREEN_WIDTH * SCREEN_HEIGHT,
+                       SCREEN_WIDTH * sizeof(uint32_t)});
+  // Skipping the boot ROM leaves VBlank requested in IF.
+  Gameboy gameboy(path.c_str(), frames, {.skip = true});
+  CPU &cpu = gameboy.get_cpu();
+  cpu.write_interrupt_enable(VBLANK_INTERRUPT);
+
+  // EI ends the batch.
+  uint64_t cycles = cpu.run_until(cpu.get_cycles() + 100);
+  check(cycles == BOOT_END_CYCLE + 1, "EI ends the batch");
+
+  // The jr after EI runs for 3 cycles, past a deadline 1 cycle away.
+  uint64_t deadline = cycles + 1;
+  cycles = cpu.run_until(deadline);
+  check(cycles == deadline + 2, "the instruction after EI ends the batch");
+
+  // Servicing the interrupt takes 5 cycles, past a deadline 1 cycle away.
+  deadline = cycles + 1;
+  cycles = cpu.run_until(deadline);
+  check(cycles == deadline + 4, "servicing an interrupt ends the batch");
+  check(!(cpu.read_interrupt_flag() & VBLANK_INTERRUPT),
+        "the interrupt was serviced");
+
+  // Back to normal batches from the vector.
+  deadline = cycles + 30;
+  cycles = cpu.run_until(deadline);
+  check(cycles >= deadline && cycles < deadline + 3,
+        "a batch after the interrupt ends at its deadline");
+
+  std::filesystem::remove(path);
+  if (failures != 0)
+    return 1;
+  std::printf("Batches end at interrupts\n");
+  return 0;
+}
@@ -0,0 +1,168 @@
+// Runs the same instruction streams through the interpreter and the
+// recompiler, from the same random register states, and checks the register
+// file, flags, PC and cycle counts come out identical. Covers every opcode
+// the recompiler emits natively on its own, and random mixes of them.
+
+#include "gameboy.h"
+#include "instruction_streams.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace gb {
+
+struct Snapshot {
+  std::array<uint16_t, WORD_REGISTER_LENGTH> pairs;
+  uint16_t pc;
+  uint64_t cycles;
+
+  bool operator==(const Snapshot &) const = default;
+};
+
+struct JitTest {
+  CPU &cpu;
+
+  void load(const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs,
+            uint16_t pc) {
+    for (std::size_t i = 0; i < pairs.size(); i++)
+      cpu.m_registers[i] = pairs[i];
+    cpu.set_flags(pairs[Registers::AF] & 0xF0);
+    cpu.m_registers.pc = pc;
+  }
+
+  Snapshot save(uint64_t cycles) {
+    cpu.get_flags();
+    Snapshot snapshot{{}, cpu.m_registers.pc, cycles};
+    for (std::size_t i = 0; i < snapshot.pairs.size(); i++)
+      snapshot.pairs[i] = cpu.m_registers[i];
+    return snapshot;
+  }
+
+  Snapshot interpret(const Stream &stream,
+                     const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs) {
+    load(pairs, stream.address);
+    uint64_t cycles = 0;
+    for (std::size_t i = 0; i < stream.instructions; i++)
+      cycles += cpu.cycle();
+    return save(cycles);
+  }
+
+  // The same steps `CPU::run` takes around a native block.
+  Snapshot recompile(const Stream &stream,
+                     const std::array<uint16_t, WORD_REGISTER_LENGTH> &pairs) {
+    CPU::Block block = cpu.decode_block(stream.address);
+    native_block_t native = cpu.compile_block(block, stream.address);
+    if (native == nullptr) {
+      cpu.flush_native_blocks();
+      native = cpu.compile_block(block, stream.address);
+    }
+
+    load(pairs, stream.address);
+    cpu.get_flags();
+    uint64_t cycles = native(&cpu, &cpu.m_registers);
+    cycles += cpu.take_extra_cycles();
+    if (block.native_tail && !cpu.m_exit_block)
+      cpu.m_registers.pc = block.end;
+    cpu.m_exit_block = false;
+    return save(cycles);
+  }
+};
+
+} // namespace gb
+
+using namespace gb;
+
+// Random register states each stream runs from.
+constexpr int RUNS = 64;
+
+// Register operands, without (HL).
+constexpr std::array<uint8_t, 7> REGISTER_OPERANDS = {0, 1, 2, 3, 4, 5, 7};
+
+// Every opcode the recompiler emits natively, with its length.
+static std::vector<std::pair<uint8_t, uint8_t>> native_opcodes() {
+  std::vector<std::pair<uint8_t, uint8_t>> opcodes = {{0x00, 1}};
+
+  // ld r,r
+  for (uint8_t dst : REGISTER_OPERANDS)
+    for (uint8_t src : REGISTER_OPERANDS)
+      opcodes.push_back({0x40 | dst << 3 | src, 1});
+  // alu a,r
+  for (uint8_t operation = 0; operation < 8; operation++)
+    for (uint8_t src : REGISTER_OPERANDS)
+      opcodes.push_back({0x80 | operation << 3 | src, 1});
+  // alu a,d8
+  for (uint8_t operation = 0; operation < 8; operation++)
+    opcodes.push_back({0xC6 | operation << 3, 2});
+  // inc r, dec r, ld r,d8
+  for (uint8_t r : REGISTER_OPERANDS) {
+    opcodes.push_back({0x04 | r << 3, 1});
+    opcodes.push_back({0x05 | r << 3, 1});
+    opcodes.push_back({0x06 | r << 3, 2});
+  }
+  // ld rr,d16, inc rr, dec rr for BC, DE and HL
+  for (uint8_t rr = 0; rr < 3; rr++) {
+    opcodes.push_back({0x01 | rr << 4, 3});
+    opcodes.push_back({0x03 | rr << 4, 1});
+    opcodes.push_back({0x0B | rr << 4, 1});
+  }
+  return opcodes;
+}
+
+int main() {
+  std::mt19937 random(0x6B);
+
+  // Each opcode on its own, then random runs of them.
+  std::vector<Stream> streams = random_streams(native_opcodes(), 200, random);
+  std::vector<uint8_t> rom = build_rom(streams);
+
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "gamerboy-jit-test.gb";
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(rom.data()), rom.size());
+
+  std::array<uint32_t, 2 * SCREEN_WIDTH * SCREEN_HEIGHT> pixels{};
+  FrameMailbox frames({pixels.data(), SCREEN_WIDTH * sizeof(uint32_t)},
+                      {pixels.data() + SCREEN_WIDTH * SCREEN_HEIGHT,
+                       SCREEN_WIDTH * sizeof(uint32_t)});
+  Gameboy gameboy(path.c_str(), frames, {.skip = true});
+  JitTest test{gameboy.get_cpu()};
+
+  int failures = 0;
+  for (const Stream &stream : streams) {
+    for (int run = 0; run < RUNS; run++) {
+      std::array<uint16_t, WORD_REGISTER_LENGTH> pairs;
+      for (uint16_t &pair : pairs)
+        pair = static_cast<uint16_t>(random());
+
+      Snapshot expected = test.interpret(stream, pairs);
+      Snapshot actual = test.recompile(stream, pairs);
+      if (expected == actual)
+        continue;
+
+      if (failures++ < 20) {
+        std::fprintf(stderr, "Mismatch in the stream at 0x%04X, opcode 0x%02X:",
+                     stream.address, stream.code[0]);
+        const char *names[] = {"AF", "BC", "DE", "HL", "SP"};
+        for (std::size_t i = 0; i < pairs.size(); i++)
+          std::fprintf(stderr, " %s %04X/%04X", names[i], expected.pairs[i],
+                       actual.pairs[i]);
+        std::fprintf(stderr, " PC %04X/%04X cycles %llu/%llu\n", expected.pc,
+                     actual.pc,
+                     static_cast<unsigned long long>(expected.cycles),
+                     static_cast<unsigned long long>(actual.cycles));
+      }
+    }
+  }
+
+  std::filesystem::remove(path);
+  if (failures != 0) {
+    std::fprintf(stderr, "%d of %zu runs differ\n", failures,
+                 streams.size() * RUNS);
+    return 1;
+  }
+  std::printf("%zu instruction streams match\n", streams.size());
+  return 0;
+}
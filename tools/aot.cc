@@ -0,0 +1,390 @@
+// gamerboy-aot: translates the reachable code of a ROM into C++.
+//
+// Code is discovered from the reset, RST and interrupt vectors and the entry
+// point. Jumps from bank 0 into 0x4000-0x7FFF can land in any switchable
+// bank, so those targets are followed in every bank. Each basic block becomes
+// one function built on the `Aot` helpers in `aot.h`. The emulator falls back
+// to the interpreter for anything that wasn't reached.
+//
+// Usage: gamerboy-aot <rom> <output.cc>
+
+#include "opcodes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using namespace gb;
+
+constexpr uint16_t BANK_SIZE = 0x4000;
+// Longest run of instructions translated into a single block.
+constexpr std::size_t MAX_BLOCK_INSTRUCTIONS = 64;
+
+constexpr const char *OPERAND_NAMES[] = {"B", "C", "D", "E",
+                                         "H", "L", "DHL", "A"};
+
+bool is_native(uint8_t opcode);
+
+struct Instruction {
+  uint16_t address;
+  uint8_t opcode;
+  uint8_t length;
+  uint16_t immediate;
+};
+
+class Translator {
+public:
+  Translator(std::vector<uint8_t> rom) : m_rom(std::move(rom)) {
+    m_banks = std::max<std::size_t>(2, m_rom.size() / BANK_SIZE);
+  }
+
+  void walk();
+  std::string emit(const std::string &name) const;
+
+private:
+  static uint32_t key(uint16_t bank, uint16_t address) {
+    return (bank << 16) | address;
+  }
+
+  uint8_t read(uint16_t bank, uint32_t address) const {
+    std::size_t offset =
+        address < BANK_SIZE ? address : bank * BANK_SIZE + address - BANK_SIZE;
+    return offset < m_rom.size() ? m_rom[offset] : 0xFF;
+  }
+
+  void add_target(uint16_t bank, uint32_t address);
+  std::vector<Instruction> decode(uint16_t bank, uint16_t address) const;
+  void successors(uint16_t bank, const Instruction &last);
+  std::string emit_block(uint32_t key,
+                         const std::vector<Instruction> &instructions) const;
+
+  std::vector<uint8_t> m_rom;
+  std::size_t m_banks;
+
+  std::vector<uint32_t> m_pending;
+  std::map<uint32_t, std::vector<Instruction>> m_blocks;
+};
+
+void Translator::add_target(uint16_t bank, uint32_t address) {
+  if (address < BANK_SIZE) {
+    m_pending.push_back(key(0, address));
+  } else if (address < 2 * BANK_SIZE) {
+    // Bank 0 doesn't know which bank is mapped when it jumps up.
+    if (bank != 0)
+      m_pending.push_back(key(bank, address));
+    else
+      for (uint16_t i = 1; i < m_banks; i++)
+        m_pending.push_back(key(i, address));
+  }
+}
+
+void Translator::walk() {
+  for (uint16_t vector = 0x00; vector <= 0x60; vector += 0x08)
+    add_target(0, vector);
+  add_target(0, 0x100);
+
+  while (!m_pending.empty()) {
+    uint32_t next = m_pending.back();
+    m_pending.pop_back();
+    if (m_blocks.count(next))
+      continue;
+
+    uint16_t bank = next >> 16;
+    std::vector<Instruction> instructions = decode(bank, next & 0xFFFF);
+    if (instructions.empty())
+      continue;
+
+    successors(bank, instructions.back());
+
+    // Blocks stop early after writes to ROM or to IF and IE, give the
+    // interpreter somewhere to come back to.
+    for (std::size_t i = 0; i + 1 < instructions.size(); i++)
+      if (!is_native(instructions[i].opcode))
+        add_target(bank, instructions[i + 1].address);
+
+    m_blocks.emplace(next, std::move(instructions));
+  }
+}
+
+std::vector<Instruction> Translator::decode(uint16_t bank,
+                                            uint16_t address) const {
+  // A block never leaves the bank it started in.
+  uint32_t end = address < BANK_SIZE ? BANK_SIZE : 2 * BANK_SIZE;
+
+  std::vector<Instruction> instructions;
+  uint32_t pc = address;
+  while (instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+    uint8_t opcode = read(bank, pc);
+    uint8_t length = OPCODE_LENGTH[opcode];
+    if (pc + length > end)
+      break;
+
+    Instruction instruction{static_cast<uint16_t>(pc), opcode, length, 0};
+    if (length > 1)
+      instruction.immediate = read(bank, pc + 1);
+    if (length > 2)
+      instruction.immediate |= read(bank, pc + 2) << 8;
+    instructions.push_back(instruction);
+
+    pc += length;
+    if (ends_block(opcode))
+      break;
+  }
+  return instructions;
+}
+
+void Translator::successors(uint16_t bank, const Instruction &last) {
+  uint32_t next = last.address + last.length;
+  int8_t offset = static_cast<int8_t>(last.immediate);
+
+  switch (last.opcode) {
+  // jr r8, jp a16
+  case 0x18:
+    add_target(bank, (next + offset) & 0xFFFF);
+    break;
+  case 0xC3:
+    add_target(bank, last.immediate);
+    break;
+  // jr cc,r8
+  case 0x20:
+  case 0x28:
+  case 0x30:
+  case 0x38:
+    add_target(bank, (next + offset) & 0xFFFF);
+    add_target(bank, next);
+    break;
+  // jp cc,a16, call a16, call cc,a16
+  case 0xC2:
+  case 0xCA:
+  case 0xD2:
+  case 0xDA:
+  case 0xC4:
+  case 0xCC:
+  case 0xCD:
+  case 0xD4:
+  case 0xDC:
+    add_target(bank, last.immediate);
+    add_target(bank, next);
+    break;
+  // rst
+  case 0xC7:
+  case 0xCF:
+  case 0xD7:
+  case 0xDF:
+  case 0xE7:
+  case 0xEF:
+  case 0xF7:
+  case 0xFF:
+    add_target(bank, last.opcode & 0x38);
+    add_target(bank, next);
+    break;
+  // ret cc, stop, halt, di, ei
+  case 0xC0:
+  case 0xC8:
+  case 0xD0:
+  case 0xD8:
+  case 0x10:
+  case 0x76:
+  case 0xF3:
+  case 0xFB:
+    add_target(bank, next);
+    break;
+  // ret, reti, jp hl and illegal opcodes have no static successor.
+  default:
+    if (!ends_block(last.opcode))
+      add_target(bank, next);
+    break;
+  }
+}
+
+// Register only instructions are written out directly so the host compiler
+// can optimise them, the rest calls the interpreter handler.
+bool is_native(uint8_t op) {
+  bool dhl = (op & 0x07) == 0x06;
+  if (op == 0x00 || op == 0x18 || op == 0xC3)
+    return true;
+  // ld r,r
+  if (op >= 0x40 && op < 0x80)
+    return op != 0x76 && !dhl && ((op >> 3) & 0x07) != 0x06;
+  // alu a,r and alu a,d8
+  if (op >= 0x80)
+    return op < 0xC0 ? !dhl : dhl;
+
+  switch (op & 0x0F) {
+  // ld rr,d16, inc rr, dec rr
+  case 0x01:
+  case 0x03:
+  case 0x0B:
+    return true;
+  // ld r,d8
+  case 0x06:
+  case 0x0E:
+    return op != 0x36;
+  }
+  return false;
+}
+
+std::string
+Translator::emit_block(uint32_t key,
+                       const std::vector<Instruction> &instructions) const {
+  char line[128];
+  std::ostringstream out;
+
+  std::snprintf(line, sizeof(line),
+                "uint32_t block_%02X_%04X(CPU &cpu) {\n  uint32_t cycles = "
+                "0;\n",
+                key >> 16, key & 0xFFFF);
+  out << line;
+
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    const Instruction &instruction = instructions[i];
+    uint8_t op = instruction.opcode;
+    uint16_t next = instruction.address + instruction.length;
+    const char *r = OPERAND_NAMES[(op >> 3) & 0x07];
+    const char *r2 = OPERAND_NAMES[op & 0x07];
+    uint8_t rr = ((op >> 4) & 0x03) + 1;
+    uint8_t operation = (op >> 3) & 0x07;
+
+    std::snprintf(line, sizeof(line), "  // 0x%04X\n", instruction.address);
+    out << line;
+
+    if (!is_native(op)) {
+      if (op == 0xCB)
+        std::snprintf(line, sizeof(line),
+                      "  cycles += Aot::execute_cb(cpu, 0x%02X, 0x%04X, "
+                      "cycles);\n",
+                      instruction.immediate, next);
+      else
+        std::snprintf(
+            line, sizeof(line),
+            "  cycles += Aot::execute(cpu, 0x%02X, 0x%04X, 0x%04X, cycles);\n",
+            op, instruction.immediate, next);
+      out << line;
+
+      // The handler has already moved PC on.
+      if (i + 1 < instructions.size())
+        out << "  if (Aot::exit_block(cpu, cycles))\n    return cycles;\n";
+      continue;
+    }
+
+    if (op == 0xC3 || op == 0x18) {
+      uint16_t target =
+          op == 0xC3 ? instruction.immediate
+                     : next + static_cast<int8_t>(instruction.immediate);
+      std::snprintf(line, sizeof(line),
+                    "  Aot::jump(cpu, 0x%04X);\n  return cycles + %u;\n}\n",
+                    target, OPCODE_CYCLES[op]);
+      out << line;
+      return out.str();
+    }
+
+    line[0] = '\0';
+    if (op >= 0x40 && op < 0x80)
+      std::snprintf(line, sizeof(line),
+                    "  Aot::write<Operand::%s>(cpu, "
+                    "Aot::read<Operand::%s>(cpu));\n",
+                    r, r2);
+    else if (op >= 0x80 && op < 0xC0)
+      std::snprintf(line, sizeof(line),
+                    "  Aot::alu<%u>(cpu, Aot::read<Operand::%s>(cpu));\n",
+                    operation, r2);
+    else if (op >= 0xC0)
+      std::snprintf(line, sizeof(line), "  Aot::alu<%u>(cpu, 0x%02X);\n",
+                    operation, instruction.immediate);
+    else if ((op & 0x0F) == 0x01)
+      std::snprintf(line, sizeof(line), "  Aot::write16<%u>(cpu, 0x%04X);\n",
+                    rr, instruction.immediate);
+    else if ((op & 0x0F) == 0x03 || (op & 0x0F) == 0x0B)
+      std::snprintf(line, sizeof(line), "  Aot::%s<%u>(cpu);\n",
+                    (op & 0x08) ? "decrement" : "increment", rr);
+    else if (op != 0x00)
+      std::snprintf(line, sizeof(line),
+                    "  Aot::write<Operand::%s>(cpu, 0x%02X);\n", r,
+                    instruction.immediate);
+    out << line;
+
+    std::snprintf(line, sizeof(line), "  cycles += %u;\n", OPCODE_CYCLES[op]);
+    out << line;
+
+    // Stops at the deadline like the interpreter would, and carries on from
+    // the next instruction in the next batch.
+    if (i + 1 < instructions.size()) {
+      std::snprintf(line, sizeof(line),
+                    "  if (Aot::exit_block(cpu, cycles)) {\n"
+                    "    Aot::jump(cpu, 0x%04X);\n    return cycles;\n  }\n",
+                    next);
+      out << line;
+    }
+  }
+
+  // The interpreter handlers update PC themselves.
+  const Instruction &end = instructions.back();
+  if (is_native(end.opcode)) {
+    std::snprintf(line, sizeof(line), "  Aot::jump(cpu, 0x%04X);\n",
+                  end.address + end.length);
+    out << line;
+  }
+  out << "  return cycles;\n}\n";
+  return out.str();
+}
+
+std::string Translator::emit(const std::string &name) const {
+  char line[128];
+  std::ostringstream out;
+
+  out << "// Generated by gamerboy-aot from " << name << ", do not edit.\n\n"
+      << "#include \"aot.h\"\n\n#include <iterator>\n\nnamespace gb {\n"
+      << "namespace {\n\n";
+
+  for (const auto &[key, instructions] : m_blocks)
+    out << emit_block(key, instructions) << "\n";
+
+  out << "} // namespace\n\nconst AotBlock Aot::blocks[] = {\n";
+  for (const auto &[key, instructions] : m_blocks) {
+    std::snprintf(line, sizeof(line), "    {0x%08X, block_%02X_%04X},\n", key,
+                  key >> 16, key & 0xFFFF);
+    out << line;
+  }
+  out << "};\n\nconst std::size_t Aot::block_count = std::size(Aot::blocks);"
+      << "\n\nconst std::array<uint8_t, 0x1C> Aot::rom_header = {";
+  for (uint16_t i = 0; i < 0x1C; i++) {
+    const char *separator = i == 0 ? "\n    " : i % 8 ? ", " : ",\n    ";
+    std::snprintf(line, sizeof(line), "%s0x%02X", separator,
+                  read(0, 0x134 + i));
+    out << line;
+  }
+  out << "};\n\n} // namespace gb\n";
+  return out.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: gamerboy-aot <rom> <output.cc>\n";
+    return 1;
+  }
+
+  std::ifstream input(argv[1], std::ios::binary);
+  std::vector<uint8_t> rom{std::istreambuf_iterator<char>(input),
+                           std::istreambuf_iterator<char>()};
+  if (rom.size() < 0x150) {
+    std::cerr << "Does this path to rom really exist?\n";
+    return 1;
+  }
+
+  Translator translator(std::move(rom));
+  translator.walk();
+
+  std::ofstream output(argv[2]);
+  output << translator.emit(argv[1]);
+  return output.good() ? 0 : 1;
+}